@@ -0,0 +1,100 @@
+#ifndef _AVR_RATCHET_HAL_HPP
+#define _AVR_RATCHET_HAL_HPP
+
+/*
+    The hardware layer of the RatchetEngine on an ATmega328P.
+
+    Time is taken from micros(). The alarm is compare A of Timer1, which runs freely with
+    the same prescaler as Timer0 (4 uS per count). An alarm more than one Timer1 cycle
+    (262 mS) away goes off early; the engine then simply finds no edge due and sets the
+    alarm again. Toggling pins writes to the PIN register, so all channels on a port are
+    toggled with a single instruction.
+*/
+
+#include <Arduino.h>
+#include "Debug.hpp"
+#include "RatchetEngine.hpp"
+
+#define AVR_RATCHET_HAL_US_PER_COUNT 4
+#define AVR_RATCHET_HAL_MAX_COUNTS 0xFF00 // Keep clear of the current count when wrapping.
+#define AVR_RATCHET_HAL_MIN_COUNTS 2      // The compare match must not be in the past already.
+
+class AvrRatchetHal {
+
+    private:
+        volatile uint8_t *ports[MAX_NR_OF_CHANNEL_PORTS];
+        volatile uint8_t *pins[MAX_NR_OF_CHANNEL_PORTS];
+        uint8_t nrOfPorts = 0;
+
+    public:
+
+        AvrRatchetHal() {}
+
+        // Let Timer1 run freely without interrupts.
+        void begin() {
+            TCCR1A = 0;
+            TCCR1B = _BV(CS11) | _BV(CS10); // Normal mode, prescaler 64.
+            TIMSK1 = 0;
+        }
+
+        void addPin(uint8_t pinNumber, uint8_t *portIndex, uint8_t *bitMask) {
+            volatile uint8_t *port = portOutputRegister(digitalPinToPort(pinNumber));
+            *bitMask = digitalPinToBitMask(pinNumber);
+            pinMode(pinNumber, OUTPUT);
+            for (uint8_t portCnt = 0; portCnt < nrOfPorts; portCnt++) {
+                if (ports[portCnt] == port) {
+                    *portIndex = portCnt;
+                    return;
+                }
+            }
+            if (nrOfPorts >= MAX_NR_OF_CHANNEL_PORTS) {
+                debug_print2("hal: no room for the port of pin %d\n", pinNumber);
+                *portIndex = 0;
+                *bitMask = 0;
+                return;
+            }
+            ports[nrOfPorts] = port;
+            pins[nrOfPorts] = portInputRegister(digitalPinToPort(pinNumber));
+            *portIndex = nrOfPorts++;
+        }
+
+        uint32_t now() {
+            return(micros());
+        }
+
+        void setAlarm(uint32_t time) {
+            int32_t counts = (int32_t)(time - micros()) / AVR_RATCHET_HAL_US_PER_COUNT;
+            if (counts < AVR_RATCHET_HAL_MIN_COUNTS) {
+                counts = AVR_RATCHET_HAL_MIN_COUNTS;
+            } else if (counts > AVR_RATCHET_HAL_MAX_COUNTS) {
+                counts = AVR_RATCHET_HAL_MAX_COUNTS;
+            }
+            OCR1A = TCNT1 + counts;
+            TIFR1 = _BV(OCF1A);
+            TIMSK1 |= _BV(OCIE1A);
+        }
+
+        void cancelAlarm() {
+            TIMSK1 &= ~_BV(OCIE1A);
+        }
+
+        void writeBits(uint8_t portIndex, uint8_t mask, uint8_t bits) {
+            *ports[portIndex] = (*ports[portIndex] & ~mask) | bits;
+        }
+
+        void toggleBits(uint8_t portIndex, uint8_t mask) {
+            *pins[portIndex] = mask; // Writing a 1 to the PIN register toggles the output.
+        }
+
+        uint8_t lock() {
+            uint8_t oldSREG = SREG;
+            cli();
+            return(oldSREG);
+        }
+
+        void unlock(uint8_t oldSREG) {
+            SREG = oldSREG;
+        }
+};
+
+#endif
@@ -148,7 +148,13 @@ class Eeprom {
                     }
                     debug_print3("eeprom: device mode: %d %s\n", settings.device_mode, mode_str[settings.device_mode].c_str());
                     digitalWrite(LED_BUILTIN, !digitalRead(LED_BUILTIN));
-                    delay(100);
+                    #ifdef HARDWARE_BURSTS
+                        // No delay(), it needs Timer0 which may be producing the output.
+                        unsigned long flashTime = millis();
+                        while ((millis() - flashTime) < 100) { }
+                    #else
+                        delay(100);
+                    #endif
                     digitalWrite(LED_BUILTIN, !digitalRead(LED_BUILTIN));
                 #else
                     debug_print("\neeprom: skipping writing settings to EEPROM.");
@@ -0,0 +1,74 @@
+#ifndef _ISR_STATS_HPP
+#define _ISR_STATS_HPP
+
+/*
+    Keeps track of the longest time each interrupt routine ran, i.e. the longest time
+    it blocked all other interrupts (or, for the deferred work, the longest time it took
+    with interrupts enabled).
+
+    Time is measured with getMicros(), which the including file must define before it
+    includes this file. Its resolution is 4 uS. Times up to 65 mS are measured correctly,
+    longer times are reported as 65535 uS. The time the Arduino core needs to dispatch
+    an interrupt attached with attachInterrupt() is not included.
+*/
+
+#include <Arduino.h>
+#include <util/atomic.h>
+#include "Debug.hpp"
+
+#define ISR_CLOCK        0
+#define ISR_RESET        1
+#define ISR_RATCHET      2
+#define ISR_PULSE        3
+#define ISR_LED_TICK     4
+#define ISR_DEFERRED     5
+#define NR_OF_ISR_STATS  6
+
+#define ISR_STATS_MAX_TIME 0xFFFF // uS
+
+class IsrStats {
+
+    private:
+        volatile unsigned int maxTimes[NR_OF_ISR_STATS];
+
+    public:
+        IsrStats() {
+            reset();
+        }
+
+        inline unsigned long start() {
+            return(getMicros());
+        }
+
+        inline void stop(byte isrNr, unsigned long startTime) {
+            unsigned long time = getMicros() - startTime;
+            if (time > ISR_STATS_MAX_TIME) {
+                time = ISR_STATS_MAX_TIME;
+            }
+            if (time > maxTimes[isrNr]) {
+                maxTimes[isrNr] = time;
+            }
+        }
+
+        unsigned int getMax(byte isrNr) {
+            unsigned int time;
+            // The deferred work runs with interrupts enabled, so the top halves may update it meanwhile.
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                time = maxTimes[isrNr];
+            }
+            return(time);
+        }
+
+        void reset() {
+            for (byte isrNr = 0; isrNr < NR_OF_ISR_STATS; isrNr++) {
+                maxTimes[isrNr] = 0;
+            }
+        }
+
+        void report() {
+            debug_print4("isr max uS: clock %u reset %u ratchet %u ", getMax(ISR_CLOCK), getMax(ISR_RESET), getMax(ISR_RATCHET));
+            debug_print4("pulse %u led tick %u deferred %u\n", getMax(ISR_PULSE), getMax(ISR_LED_TICK), getMax(ISR_DEFERRED));
+        }
+};
+
+#endif
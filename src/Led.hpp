@@ -10,46 +10,41 @@
 #define LED_FAST_FLASH 4
 #define LED_REDICULOUS_FLASH 5
 
+// Brightness is bit angle modulated using LED_BRIGHTNESS_BITS bits,
+// so there are 2^LED_BRIGHTNESS_BITS - 1 visible levels.
+#define LED_BRIGHTNESS_BITS 3
+#define LED_MIN_BRIGHTNESS 1
+#define LED_MAX_BRIGHTNESS ((1 << LED_BRIGHTNESS_BITS) - 1)
+
+/*
+    A Led does not write to its pin itself. It only describes where it is connected
+    and what it should look like. The LedCompositor renders all leds and writes them
+    to the output ports.
+*/
 class Led {
 
     private:
-        byte pinNumber;
-        byte state;
+        volatile uint8_t *port;
+        byte bitMask;
+        volatile byte state;
+        volatile byte brightness;
 
         bool onOffState;
-        unsigned long onTime[6] = { 0L, 1000L, 500L, 250L, 130L, 25L };
-        unsigned long oldTime;
+        unsigned int flashCountDown;
+
+        friend class LedCompositor;
 
     public:
 
         Led() {}
 
-        Led(byte pinNumber, byte initialState): pinNumber(pinNumber), state(initialState) {
-            oldTime = millis();
+        Led(byte pinNumber, byte initialState): state(initialState) {
+            port = portOutputRegister(digitalPinToPort(pinNumber));
+            bitMask = digitalPinToBitMask(pinNumber);
+            brightness = LED_MAX_BRIGHTNESS;
             onOffState = false;
-        }
-
-        void setState(byte someState) {
-            state = someState;
-        }
-
-        void tick() {
-            if (state < LED_SLOW_FLASH) {
-                // We do not flash.
-                if (state == LED_OFF) { // The led is switched off.
-                    digitalWrite(pinNumber, LOW); // Switch led OFF.
-                } else { // The led is lit continuously.
-                    digitalWrite(pinNumber, HIGH); // Switch led ON.
-                }
-            } else {
-                // We flash.
-                if ((millis() - oldTime) > onTime[state]) {
-                    oldTime = millis();
-                    onOffState = !onOffState;
-                    digitalWrite(pinNumber, onOffState);
-                }
-            }
+            flashCountDown = 0;
         }
 };
 
-#endif
\ No newline at end of file
+#endif
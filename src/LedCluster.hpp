@@ -5,6 +5,7 @@
 #include <LibPrintf.h>
 #include "Debug.hpp"
 #include "Led.hpp"
+#include "LedCompositor.hpp"
 
 #define NR_TESTS       5
 class LedCluster { // a group of 3 leds that show MULT or DIV mode and the ONE status.
@@ -13,15 +14,16 @@ class LedCluster { // a group of 3 leds that show MULT or DIV mode and the ONE s
     byte pinA;
     byte pinB;
     byte pinC;
-    Led ledDiv;
-    Led ledMult;
-    Led ledOne;
+    LedCompositor *compositor;
+    byte ledDiv;
+    byte ledMult;
+    byte ledOne;
 
   public:
-    LedCluster(byte _pinA, byte _pinB, byte _pinC): pinA(_pinA), pinB(_pinB), pinC(_pinC) {
-      ledDiv  = Led(pinA, LED_OFF); // DIV
-      ledMult = Led(pinB, LED_OFF); // MULT
-      ledOne  = Led(pinC, LED_OFF); // ONE
+    LedCluster(LedCompositor *_compositor, byte _pinA, byte _pinB, byte _pinC): pinA(_pinA), pinB(_pinB), pinC(_pinC), compositor(_compositor) {
+      ledDiv  = compositor->addLed(pinA, LED_OFF); // DIV
+      ledMult = compositor->addLed(pinB, LED_OFF); // MULT
+      ledOne  = compositor->addLed(pinC, LED_OFF); // ONE
       // Initialize all leds to off.
       setMode(INIT);
     }
@@ -29,40 +31,48 @@ class LedCluster { // a group of 3 leds that show MULT or DIV mode and the ONE s
     void setMode(byte mode) {
       switch(mode) {
         case INIT:
-          ledDiv.setState(LED_OFF);
-          ledMult.setState(LED_OFF);
-          ledOne.setState(LED_OFF);
+          compositor->setState(ledDiv, LED_OFF);
+          compositor->setState(ledMult, LED_OFF);
+          compositor->setState(ledOne, LED_OFF);
           break;
         case DIV:
-          ledDiv.setState(LED_ON);
-          ledMult.setState(LED_OFF);
-          ledOne.setState(LED_OFF);
+          compositor->setState(ledDiv, LED_ON);
+          compositor->setState(ledMult, LED_OFF);
+          compositor->setState(ledOne, LED_OFF);
           break;
         case ONE:
-          ledOne.setState(LED_ON);
+          compositor->setState(ledOne, LED_ON);
           // We leave the other 2 leds as they were.
           break;
         case MULT:
-          ledOne.setState(LED_OFF);
-          ledDiv.setState(LED_OFF);
-          ledMult.setState(LED_ON);
+          compositor->setState(ledOne, LED_OFF);
+          compositor->setState(ledDiv, LED_OFF);
+          compositor->setState(ledMult, LED_ON);
           break;
         case MAX_MULT:
-          ledOne.setState(LED_OFF);
-          ledDiv.setState(LED_OFF);
-          ledMult.setState(LED_SLOW_FLASH);
+          compositor->setState(ledOne, LED_OFF);
+          compositor->setState(ledDiv, LED_OFF);
+          compositor->setState(ledMult, LED_SLOW_FLASH);
           // We leave the other 2 leds as they were.
           break;
+        case RATIO:
+          compositor->setState(ledOne, LED_OFF);
+          compositor->setState(ledDiv, LED_ON);
+          compositor->setState(ledMult, LED_ON);
+          break;
         default:
           // This should never happen!
           debug_print2("setMode unknown mode: %0x02\n", mode);
       }
     }
 
-    void tick() {
-      ledDiv.tick();
-      ledMult.tick();
-      ledOne.tick();
+    // Dim the DIV and MULT leds so that their brightness shows the current
+    // multiplication or division factor relative to its maximum value.
+    // A frac of 0 turns the leds off, 1 ... maxFrac is shown from dim to bright.
+    void showFraction(int frac, int maxFrac) {
+      byte brightness = (frac <= 0) ? 0 : map(frac, 1, maxFrac, LED_MIN_BRIGHTNESS, LED_MAX_BRIGHTNESS);
+      compositor->setBrightness(ledDiv, brightness);
+      compositor->setBrightness(ledMult, brightness);
     }
 };
 
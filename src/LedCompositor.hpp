@@ -0,0 +1,155 @@
+#ifndef _LED_COMPOSITOR_HPP
+#define _LED_COMPOSITOR_HPP
+
+/*
+    The LedCompositor owns all leds of the module. Callers (the main loop as well as
+    interrupt routines) only change the state or brightness of a led, which costs
+    a couple of byte writes. The actual rendering is done from one shared timer tick:
+
+    - the flash timers of all leds are counted down on the tick instead of each led polling millis(),
+    - a frame (bits to be lit per port per brightness bit) is only recomputed when something changed,
+    - each port is written at most once per tick and only when its led bits differ from what was written before,
+    - brightness is produced by bit angle modulation (BAM): brightness bit n is shown for 2^n ticks.
+
+    With LED_BRIGHTNESS_BITS 3 and a 1 kHz tick a BAM frame takes 7 ticks, i.e. the leds are refreshed at ~143 Hz.
+    A led that is fully on or off produces the same bits in every BAM slot, so no port writes are done for it at all.
+*/
+
+#include <Arduino.h>
+#include "Debug.hpp"
+#include "Led.hpp"
+
+#define MAX_NR_OF_COMPOSITOR_LEDS 6
+#define MAX_NR_OF_COMPOSITOR_PORTS 3
+#define LED_COMPOSITOR_TICK_TIME 1 // Time in mS between two calls to tick().
+
+class LedCompositor {
+
+    private:
+        Led leds[MAX_NR_OF_COMPOSITOR_LEDS];
+        byte ledPort[MAX_NR_OF_COMPOSITOR_LEDS]; // Index into ports[] for every led.
+        byte nrOfLeds = 0;
+
+        volatile uint8_t *ports[MAX_NR_OF_COMPOSITOR_PORTS];
+        byte portMask[MAX_NR_OF_COMPOSITOR_PORTS];  // The bits of a port that belong to our leds.
+        byte writtenBits[MAX_NR_OF_COMPOSITOR_PORTS]; // The led bits we wrote to the port the last time.
+        byte frame[MAX_NR_OF_COMPOSITOR_PORTS][LED_BRIGHTNESS_BITS]; // Led bits to be lit per BAM slot.
+        byte nrOfPorts = 0;
+
+        volatile bool dirty = true;
+        byte bamTick = 0;
+
+        // Flash half periods in mS, indexed by led state.
+        const unsigned int onTime[6] = { 0, 1000, 500, 250, 130, 25 };
+
+        byte findOrAddPort(volatile uint8_t *port) {
+            for (byte portCnt = 0; portCnt < nrOfPorts; portCnt++) {
+                if (ports[portCnt] == port) {
+                    return(portCnt);
+                }
+            }
+            ports[nrOfPorts] = port;
+            portMask[nrOfPorts] = 0;
+            writtenBits[nrOfPorts] = 0;
+            return(nrOfPorts++);
+        }
+
+        void render() {
+            dirty = false;
+            for (byte portCnt = 0; portCnt < nrOfPorts; portCnt++) {
+                for (byte bitCnt = 0; bitCnt < LED_BRIGHTNESS_BITS; bitCnt++) {
+                    frame[portCnt][bitCnt] = 0;
+                }
+            }
+            for (byte ledCnt = 0; ledCnt < nrOfLeds; ledCnt++) {
+                Led *led = &leds[ledCnt];
+                bool lit = (led->state == LED_ON) || ((led->state >= LED_SLOW_FLASH) && led->onOffState);
+                if (lit) {
+                    for (byte bitCnt = 0; bitCnt < LED_BRIGHTNESS_BITS; bitCnt++) {
+                        if (led->brightness & (1 << bitCnt)) {
+                            frame[ledPort[ledCnt]][bitCnt] |= led->bitMask;
+                        }
+                    }
+                }
+            }
+        }
+
+        // Return the brightness bit to show during this tick of the BAM frame.
+        // Bit n is shown for 2^n consecutive ticks.
+        byte bamBit() {
+            byte bitCnt = 0;
+            byte slot = bamTick + 1;
+            while (slot >>= 1) {
+                bitCnt++;
+            }
+            return(bitCnt);
+        }
+
+    public:
+
+        LedCompositor() {}
+
+        // Add a led to the compositor and return its handle.
+        byte addLed(byte pinNumber, byte initialState = LED_OFF) {
+            if (nrOfLeds >= MAX_NR_OF_COMPOSITOR_LEDS) {
+                debug_print2("compositor: no room for led on pin %d\n", pinNumber);
+                return(0);
+            }
+            leds[nrOfLeds] = Led(pinNumber, initialState);
+            ledPort[nrOfLeds] = findOrAddPort(leds[nrOfLeds].port);
+            portMask[ledPort[nrOfLeds]] |= leds[nrOfLeds].bitMask;
+            dirty = true;
+            return(nrOfLeds++);
+        }
+
+        // May be called from interrupt context.
+        void setState(byte ledNr, byte someState) {
+            if (leds[ledNr].state != someState) {
+                leds[ledNr].state = someState;
+                dirty = true;
+            }
+        }
+
+        // Set the brightness to a value from 0 ... LED_MAX_BRIGHTNESS.
+        // May be called from interrupt context.
+        void setBrightness(byte ledNr, byte someBrightness) {
+            if (someBrightness > LED_MAX_BRIGHTNESS) {
+                someBrightness = LED_MAX_BRIGHTNESS;
+            }
+            if (leds[ledNr].brightness != someBrightness) {
+                leds[ledNr].brightness = someBrightness;
+                dirty = true;
+            }
+        }
+
+        // Must be called every LED_COMPOSITOR_TICK_TIME mS from the timer interrupt.
+        void tick() {
+            for (byte ledCnt = 0; ledCnt < nrOfLeds; ledCnt++) {
+                Led *led = &leds[ledCnt];
+                if (led->state >= LED_SLOW_FLASH) {
+                    if ((led->flashCountDown == 0) || (--led->flashCountDown == 0)) {
+                        led->flashCountDown = onTime[led->state] / LED_COMPOSITOR_TICK_TIME;
+                        led->onOffState = !led->onOffState;
+                        dirty = true;
+                    }
+                }
+            }
+            if (dirty) {
+                render();
+            }
+            if (++bamTick >= LED_MAX_BRIGHTNESS) {
+                bamTick = 0;
+            }
+            byte bitCnt = bamBit();
+            for (byte portCnt = 0; portCnt < nrOfPorts; portCnt++) {
+                byte bits = frame[portCnt][bitCnt];
+                if (bits != writtenBits[portCnt]) {
+                    // One read-modify-write per port. We run from an ISR so this can not be interrupted.
+                    *ports[portCnt] = (*ports[portCnt] & ~portMask[portCnt]) | bits;
+                    writtenBits[portCnt] = bits;
+                }
+            }
+        }
+};
+
+#endif
@@ -86,6 +86,11 @@ class LFSR_RandomNumberGenerator {
             32 bits: 1567 mS -> 15.67 micro seconds per calculation
             7 bits :  309 mS ->  3.09 miro seconds per calculation
             Note, this method will generate a random number excluding the value for upperLimit !
+
+            Note, the result is rand(nrOfBits) % (upperLimit - lowerLimit), which is only uniform when
+            the difference is a power of 2. E.g. for 0 ... 99 from 7 bits the values 0 ... 27 come twice
+            as often as 28 ... 99, so a chance level of 30 passes 45% of the time. tools/rng_quality.cpp
+            measures this for every bit width.
         */
         int getRandomNumber(int lowerLimit, int upperLimit, int nrOfBits) {
             if (lowerLimit >= upperLimit) {
@@ -0,0 +1,324 @@
+#ifndef _RATCHET_ENGINE_HPP
+#define _RATCHET_ENGINE_HPP
+
+/*
+    A ratchet engine for several output channels which share one clock input and one timer.
+
+    Every channel has its own mode, factor, chance and output pin. All channels share one
+    tempo tracker, so a burst on each channel is sized to the (possibly swung) interval it
+    occupies. The edges of all bursts are scheduled in absolute time on one timer:
+
+    - clockEdge() (from the clock interrupt) decides for every channel what its next beat
+      looks like and starts the bursts; the heavy work (random numbers) is done before
+      the engine state is touched, so it may run with interrupts enabled,
+    - the channels with a pending edge are kept in a binary heap ordered by the time of
+      their next edge, so the timer only ever waits for the earliest edge and handling an
+      edge costs O(log channels) instead of looking at every channel,
+    - all edges which are due at the same time (ratchets of the same beat usually are) are
+      collected per port and written with a single port write.
+
+    The hardware is reached through a Hal class (see AvrRatchetHal.hpp) which supplies the
+    time in microseconds, a one shot alarm, pin writes and a critical section. That keeps
+    the engine free of AVR registers, so it can also be compiled and run on a Linux host.
+*/
+
+#include <stdint.h>
+#include "RandomNumberGenerator.hpp"
+#include "SwingTracker.hpp"
+
+#define MAX_NR_OF_CHANNELS 6
+#define MAX_NR_OF_CHANNEL_PORTS 3
+
+// Channel modes, same values as the device modes.
+#define CHANNEL_DIV 1
+#define CHANNEL_MULT 3
+#define CHANNEL_MAX_MULT 4
+
+#define CHANNEL_CHANCE_BITS 7 // Bits used to draw the chance, see LFSR_RandomNumberGenerator.
+#define CHANNEL_COUNT_BITS 4  // Bits used to draw the number of ratchets in MAX_MULT.
+#define CHANNEL_RESET_GUARD_FRACTION 4 // A clock edge within 1/4 beat after a reset belongs to the reset beat.
+
+// Map a pot or CV value (0 ... 1023) to an index into a table of nrOfValues values.
+inline uint8_t potValueToIndex(int potValue, uint8_t nrOfValues) {
+    return((long)potValue * nrOfValues / 1024);
+}
+
+struct RatchetChannel {
+    // Settings, may be changed at any time.
+    volatile uint8_t mode = CHANNEL_MULT;
+    volatile uint8_t factor = 1;     // Number of ratchets (MULT) or division (DIV). The minimum in MAX_MULT.
+    volatile uint8_t maxFactor = 1;  // The maximum number of ratchets in MAX_MULT.
+    volatile uint8_t chance = 100;   // Chance to ratchet (MULT) or to produce a gate (DIV), 0 ... 100.
+    // The output.
+    uint8_t portIndex = 0;
+    uint8_t bitMask = 0;
+    bool level = false;
+    // The running burst.
+    uint32_t nextEdgeTime = 0;
+    uint32_t halfPeriod = 0;
+    uint8_t edgesLeft = 0;
+    // Decision state.
+    uint8_t divCount = 0;
+    volatile bool oddsInFavour = false; // The outcome of the last chance draw, e.g. for a led.
+    // The next beat as decided by clockEdge().
+    uint8_t nextPulses = 0;
+    bool nextLevel = false;
+};
+
+template <class Hal> class RatchetEngine {
+
+    private:
+        Hal *hal;
+        LFSR_RandomNumberGenerator *randomNumberGenerator;
+        RatchetChannel channels[MAX_NR_OF_CHANNELS];
+        uint8_t nrOfChannels = 0;
+        uint8_t heap[MAX_NR_OF_CHANNELS]; // Channels with a pending edge, earliest edge first.
+        uint8_t heapSize = 0;
+        SwingTracker tempo;
+        uint32_t lastEdgeTime = 0;
+        bool edgeSeen = false;
+        uint32_t resetTime = 0;
+        bool resetBeatPending = false;
+        uint8_t chanceBits = CHANNEL_CHANCE_BITS;
+        uint8_t countBits = CHANNEL_COUNT_BITS;
+
+        static bool isEarlier(uint32_t time, uint32_t otherTime) {
+            return((int32_t)(time - otherTime) < 0);
+        }
+
+        bool edgeBefore(uint8_t heapIndex, uint8_t otherHeapIndex) {
+            return(isEarlier(channels[heap[heapIndex]].nextEdgeTime, channels[heap[otherHeapIndex]].nextEdgeTime));
+        }
+
+        void swap(uint8_t heapIndex, uint8_t otherHeapIndex) {
+            uint8_t channelNr = heap[heapIndex];
+            heap[heapIndex] = heap[otherHeapIndex];
+            heap[otherHeapIndex] = channelNr;
+        }
+
+        void siftUp(uint8_t heapIndex) {
+            while (heapIndex > 0) {
+                uint8_t parent = (heapIndex - 1) / 2;
+                if (!edgeBefore(heapIndex, parent)) {
+                    return;
+                }
+                swap(heapIndex, parent);
+                heapIndex = parent;
+            }
+        }
+
+        void siftDown(uint8_t heapIndex) {
+            while (true) {
+                uint8_t earliest = heapIndex;
+                uint8_t child = 2 * heapIndex + 1;
+                if ((child < heapSize) && edgeBefore(child, earliest)) {
+                    earliest = child;
+                }
+                child++;
+                if ((child < heapSize) && edgeBefore(child, earliest)) {
+                    earliest = child;
+                }
+                if (earliest == heapIndex) {
+                    return;
+                }
+                swap(heapIndex, earliest);
+                heapIndex = earliest;
+            }
+        }
+
+        bool drawChance(RatchetChannel *channel) {
+            channel->oddsInFavour = randomNumberGenerator->getRandomNumber(0, 100, chanceBits) < channel->chance;
+            return(channel->oddsInFavour);
+        }
+
+        // Decide what the beat of a channel looks like. Does not touch the running bursts.
+        void decide(RatchetChannel *channel, bool resetBeat) {
+            uint8_t factor = channel->factor;
+            channel->nextPulses = 0;
+            channel->nextLevel = false;
+            if (channel->mode == CHANNEL_DIV) {
+                // As in the single channel firmware: DIV 1 passes the clock on as a gate of half a beat,
+                // a higher division gives a gate which lasts until the next clock edge.
+                if (resetBeat) {
+                    channel->divCount = 0;
+                    channel->nextLevel = (factor > 0);
+                } else if (factor > 0) {
+                    channel->divCount++;
+                    if (drawChance(channel) && (channel->divCount >= factor)) {
+                        channel->divCount = 0;
+                        channel->nextLevel = true;
+                    }
+                }
+                if (channel->nextLevel && (factor == 1)) {
+                    channel->nextPulses = 1;
+                }
+                return;
+            }
+            if (channel->mode == CHANNEL_MAX_MULT) {
+                factor = randomNumberGenerator->getRandomNumber(factor, channel->maxFactor + 1, countBits);
+            }
+            if (factor == 0) {
+                return;
+            }
+            channel->nextLevel = true;
+            if ((factor == 1) || ((channel->mode == CHANNEL_MULT) && !drawChance(channel))) {
+                channel->nextPulses = 1;
+            } else {
+                channel->nextPulses = factor;
+            }
+        }
+
+        // Start the decided beats of all channels at startTime. The bursts last beatTime.
+        void startBeats(uint32_t startTime, uint32_t beatTime) {
+            uint8_t setBits[MAX_NR_OF_CHANNEL_PORTS] = { 0 };
+            uint8_t changedBits[MAX_NR_OF_CHANNEL_PORTS] = { 0 };
+            uint8_t lockState = hal->lock();
+            heapSize = 0;
+            for (uint8_t channelNr = 0; channelNr < nrOfChannels; channelNr++) {
+                RatchetChannel *channel = &channels[channelNr];
+                channel->level = channel->nextLevel;
+                changedBits[channel->portIndex] |= channel->bitMask;
+                if (channel->level) {
+                    setBits[channel->portIndex] |= channel->bitMask;
+                }
+                channel->edgesLeft = 0;
+                if (channel->nextPulses > 0) {
+                    channel->halfPeriod = beatTime / 2 / channel->nextPulses;
+                    channel->edgesLeft = 2 * channel->nextPulses - 1;
+                    channel->nextEdgeTime = startTime + channel->halfPeriod;
+                    heap[heapSize] = channelNr;
+                    siftUp(heapSize++);
+                }
+            }
+            for (uint8_t portIndex = 0; portIndex < MAX_NR_OF_CHANNEL_PORTS; portIndex++) {
+                if (changedBits[portIndex]) {
+                    hal->writeBits(portIndex, changedBits[portIndex], setBits[portIndex]);
+                }
+            }
+            armAlarm();
+            hal->unlock(lockState);
+        }
+
+        void armAlarm() {
+            if (heapSize > 0) {
+                hal->setAlarm(channels[heap[0]].nextEdgeTime);
+            } else {
+                hal->cancelAlarm();
+            }
+        }
+
+    public:
+
+        RatchetEngine(Hal *someHal, LFSR_RandomNumberGenerator *someRandomNumberGenerator):
+            hal(someHal), randomNumberGenerator(someRandomNumberGenerator) { }
+
+        // Add a channel with its output on pinNumber and return its number.
+        uint8_t addChannel(uint8_t pinNumber, uint8_t mode, uint8_t factor, uint8_t chance = 100) {
+            if (nrOfChannels >= MAX_NR_OF_CHANNELS) {
+                return(nrOfChannels - 1);
+            }
+            RatchetChannel *channel = &channels[nrOfChannels];
+            hal->addPin(pinNumber, &channel->portIndex, &channel->bitMask);
+            channel->mode = mode;
+            channel->factor = factor;
+            channel->maxFactor = factor;
+            channel->chance = chance;
+            return(nrOfChannels++);
+        }
+
+        // Change the number of random bits used to draw the chance and the number of ratchets.
+        void setRandomBits(uint8_t someChanceBits, uint8_t someCountBits) {
+            chanceBits = someChanceBits;
+            countBits = someCountBits;
+        }
+
+        RatchetChannel *getChannel(uint8_t channelNr) {
+            return(&channels[channelNr]);
+        }
+
+        uint8_t getNrOfChannels() {
+            return(nrOfChannels);
+        }
+
+        // The expected length of the beat which started with the last clock edge.
+        uint32_t getBeatTime() {
+            return(tempo.getInterval(0));
+        }
+
+        SwingTracker *getTempo() {
+            return(&tempo);
+        }
+
+        // Cancel all bursts, e.g. from the top half of a clock or reset edge. O(1).
+        void stopBursts() {
+            uint8_t lockState = hal->lock();
+            heapSize = 0;
+            hal->cancelAlarm();
+            hal->unlock(lockState);
+        }
+
+        // Handle a clock edge which arrived at time. May run with interrupts enabled, as long as
+        // it is not interrupted by another call to clockEdge() or reset().
+        void clockEdge(uint32_t time) {
+            if (edgeSeen) {
+                tempo.addInterval(time - lastEdgeTime);
+            }
+            lastEdgeTime = time;
+            edgeSeen = true;
+            if (resetBeatPending) {
+                resetBeatPending = false;
+                if ((time - resetTime) < (getBeatTime() / CHANNEL_RESET_GUARD_FRACTION)) {
+                    // This edge belongs to the beat already started by the reset.
+                    return;
+                }
+            }
+            if (!tempo.isStarted()) { // We need one interval before a burst can be sized.
+                return;
+            }
+            for (uint8_t channelNr = 0; channelNr < nrOfChannels; channelNr++) {
+                decide(&channels[channelNr], false);
+            }
+            startBeats(time, getBeatTime());
+        }
+
+        // Handle a reset edge which arrived at time. The reset edge is the first beat.
+        void reset(uint32_t time) {
+            resetTime = time;
+            resetBeatPending = true;
+            if (!tempo.isStarted()) {
+                return;
+            }
+            for (uint8_t channelNr = 0; channelNr < nrOfChannels; channelNr++) {
+                decide(&channels[channelNr], true);
+            }
+            // The clock edge which belongs to this beat comes right after the reset.
+            startBeats(time, tempo.getInterval(1));
+        }
+
+        // Produce all edges which are due at time now. Called when the alarm goes off.
+        void onAlarm(uint32_t now) {
+            uint8_t toggleBits[MAX_NR_OF_CHANNEL_PORTS] = { 0 };
+            uint8_t lockState = hal->lock();
+            while ((heapSize > 0) && !isEarlier(now, channels[heap[0]].nextEdgeTime)) {
+                RatchetChannel *channel = &channels[heap[0]];
+                channel->level = !channel->level;
+                toggleBits[channel->portIndex] ^= channel->bitMask;
+                if (--channel->edgesLeft > 0) {
+                    // Edges are computed from the start of the burst, so they do not drift.
+                    channel->nextEdgeTime += channel->halfPeriod;
+                } else {
+                    heap[0] = heap[--heapSize];
+                }
+                siftDown(0);
+            }
+            for (uint8_t portIndex = 0; portIndex < MAX_NR_OF_CHANNEL_PORTS; portIndex++) {
+                if (toggleBits[portIndex]) {
+                    hal->toggleBits(portIndex, toggleBits[portIndex]);
+                }
+            }
+            armAlarm();
+            hal->unlock(lockState);
+        }
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef _SWING_TRACKER_HPP
+#define _SWING_TRACKER_HPP
+
+/*
+    Tracks the intervals of a clock that may be swung, i.e. whose intervals repeat
+    a pattern like long, short, long, short (2 steps) or long, short, short (3 steps).
+
+    For every pattern length (1, 2 and 3 steps) there is an estimate of the interval
+    of each step. Every new interval updates the estimate of its step in each pattern
+    by a fraction of the difference (an exponential moving average, so shifts only),
+    and it updates how well that pattern predicted the interval. The pattern which
+    predicts best is used, a longer one only when it is clearly better than a shorter
+    one, so a straight clock is never mistaken for a swung one. The work per interval
+    is the same whatever the history, so it can be done for every clock pulse.
+*/
+
+#include <stdint.h>
+
+#define SWING_MAX_STEPS 3
+#define SWING_NR_OF_ESTIMATES 6 // 1 + 2 + 3 steps.
+#define SWING_SMOOTHING_SHIFT 2 // A new interval moves the estimate of its step by 1/4 of the difference.
+#define SWING_ERROR_SHIFT 3     // The prediction error is averaged over about 8 intervals.
+#define SWING_RESTART_FACTOR 4  // An interval this many times longer (a pause) or shorter than expected means a new clock.
+
+class SwingTracker {
+
+    private:
+        uint32_t estimates[SWING_NR_OF_ESTIMATES];
+        uint32_t errors[SWING_MAX_STEPS + 1];   // Mean absolute prediction error per pattern length.
+        uint8_t steps[SWING_MAX_STEPS + 1];     // The step of the next interval per pattern length.
+        const uint8_t firstEstimate[SWING_MAX_STEPS + 1] = { 0, 0, 1, 3 };
+        uint8_t patternLength = 1;
+        bool started = false;
+        uint8_t smoothingShift = SWING_SMOOTHING_SHIFT;
+        uint8_t errorShift = SWING_ERROR_SHIFT;
+
+        // Move value towards target by 1/2^shift of their difference.
+        static uint32_t approach(uint32_t value, uint32_t target, uint8_t shift) {
+            if (target > value) {
+                return(value + ((target - value) >> shift));
+            }
+            return(value - ((value - target) >> shift));
+        }
+
+        void restart(uint32_t interval) {
+            for (uint8_t estimateCnt = 0; estimateCnt < SWING_NR_OF_ESTIMATES; estimateCnt++) {
+                estimates[estimateCnt] = interval;
+            }
+            for (uint8_t length = 1; length <= SWING_MAX_STEPS; length++) {
+                errors[length] = 0;
+                steps[length] = 0;
+            }
+            patternLength = 1;
+            started = true;
+        }
+
+    public:
+
+        SwingTracker() {
+            restart(0);
+            started = false;
+        }
+
+        // Change how fast the estimates (and the prediction errors) follow the clock.
+        void setSmoothing(uint8_t someSmoothingShift, uint8_t someErrorShift) {
+            smoothingShift = someSmoothingShift;
+            errorShift = someErrorShift;
+        }
+
+        // Add the interval which ended with the last clock pulse.
+        void addInterval(uint32_t interval) {
+            if (started && (interval / SWING_RESTART_FACTOR > estimates[0])) {
+                // The clock paused. The gap says nothing about the new tempo, so wait for the next interval.
+                started = false;
+                return;
+            }
+            if (!started || (estimates[0] / SWING_RESTART_FACTOR > interval)) {
+                restart(interval);
+                return;
+            }
+            for (uint8_t length = 1; length <= SWING_MAX_STEPS; length++) {
+                uint32_t *estimate = &estimates[firstEstimate[length] + steps[length]];
+                uint32_t difference = (interval > *estimate) ? (interval - *estimate) : (*estimate - interval);
+                errors[length] = approach(errors[length], difference, errorShift);
+                *estimate = approach(*estimate, interval, smoothingShift);
+                if (++steps[length] >= length) {
+                    steps[length] = 0;
+                }
+            }
+            // Prefer the shortest pattern, unless a longer one has a 25% smaller error.
+            patternLength = 1;
+            uint32_t bestError = errors[1];
+            for (uint8_t length = 2; length <= SWING_MAX_STEPS; length++) {
+                if (errors[length] < bestError - (bestError >> 2)) {
+                    patternLength = length;
+                    bestError = errors[length];
+                }
+            }
+        }
+
+        // Return the expected interval which starts stepsAhead intervals after the last clock pulse.
+        uint32_t getInterval(uint8_t stepsAhead = 0) {
+            uint8_t step = steps[patternLength] + stepsAhead;
+            while (step >= patternLength) {
+                step -= patternLength;
+            }
+            return(estimates[firstEstimate[patternLength] + step]);
+        }
+
+        // The number of steps of the detected pattern, 1 for a straight clock.
+        uint8_t getPatternLength() {
+            return(patternLength);
+        }
+
+        bool isStarted() {
+            return(started);
+        }
+};
+
+#endif
@@ -38,8 +38,48 @@
     determine the maximum number of output gates as a result of one input gate signal.
     The minimum output gates produced is 1.
 
+  October 19, 2026: v0.4
+  - All leds are rendered by a led compositor running off Timer2. Ports are only written when a led changes
+    and the brightness of the DIV and MULT leds shows the current division or multiplication factor.
+  - The reset input now works in all modes. A running burst is cancelled and the reset edge becomes the
+    first beat, so that modules sharing one reset line lock together.
+  - Added a high rate mode which is switched on automatically for input clocks faster than
+    HIGH_RATE_ENTER_CYCLE_TIME. No ADC reads or random numbers are computed per clock edge in this mode.
+    tools/test_high_rate.cpp checks on the emulator that it is entered and counts exactly from 500 Hz to 50 kHz.
+  - Every mode has its own clock edge handler. The handler for the current mode is attached to INT0
+    whenever the mode changes, so the interrupt routine no longer tests the mode on every edge.
+  - The clock and reset interrupt routines only latch the time and set the output to a level prepared from the
+    last known factor and chance. The rest is deferred to a bottom half which runs with interrupts enabled, so
+    neither the output nor the ratchet edges are delayed by ADC reads. With DEBUG defined the longest run time of
+    every interrupt routine is reported.
+  - Added PREDICTIVE_OUTPUT: beats are scheduled against the predicted next clock edge, so the output does not
+    lag the input. When the input clock stops, FLYWHEEL_BEATS more beats are produced at the last tempo.
+    tools/bench_prediction.cpp benchmarks its lag and dropouts against the reactive output on the emulator.
+  - Added RATIO mode (double click from MAX_MULT): the output runs at p/q times the input clock for ratios like
+    3:2 or 5:4, produced by a phase accumulator that is synchronised to the input clock every q pulses.
+  - Added SWING_TRACKING: a swung input clock (repeating patterns of 2 or 3 intervals) is detected and every
+    burst is sized to the interval it occupies, so ratchets no longer overrun short beats or leave gaps in long ones.
+  - Added HARDWARE_BURSTS: Timer0 toggles CLOCK_OUT (D5/OC0B) itself during a burst, so burst edges no longer
+    jitter with the interrupt load. millis() is then counted by the Timer2 system tick.
+  - Added MULTI_CHANNEL: a ratchet engine (RatchetEngine.hpp) produces several channels, each with its own mode,
+    factor, chance and output pin, from one timer and one tempo tracker. Its DIV gates are those of the gate
+    out: half a beat for DIV 1, up to the next clock pulse otherwise. The engine also runs on a Linux host,
+    see tools/simulate_channels.cpp and tools/test_div.cpp; tools/test_multi_channel.cpp runs the firmware
+    with MULTI_CHANNEL on the emulated ATmega328P.
+  - Host tests in tools/: test_swing.cpp (SwingTracker), test_ratio.cpp (RATIO mode on the emulator),
+    test_leds.cpp (LedCompositor brightness, flashing and port writes) and test_reset.cpp (the output is set at
+    the reset edge and the burst restarts there, on the emulator).
+  - Pot values are mapped to table indices by potValueToIndex() in all modes. tools/sweep.cpp runs this firmware
+    on an emulated ATmega328P (tools/FirmwareHost.hpp) and compares NR_OF_CYCLES, POTMETER_SCAN_INTERVAL_TIME,
+    the random bits and the MULT pot table over thousands of simulated modules.
+  - Added tools/rng_quality.cpp, which measures the per-value probabilities of LFSR_RandomNumberGenerator for
+    every seed and bit width over a full LFSR period, including the skew of the 7 bit chance draw.
+  - Added tools/replay_capture.cpp, which replays sigrok/CSV logic analyzer captures of real clocks through the
+    ratchet engine and writes CLOCK_OUT back in the same format for overlay in a waveform viewer.
+
 */
 #include <Arduino.h>
+#include <util/atomic.h>
 #include "MillisDelay.hpp"
 
 #define DEBUG
@@ -60,6 +100,9 @@
 
 #include "OneButton.h"
 #include "RandomNumberGenerator.hpp"
+#include "SwingTracker.hpp"
+#include "RatchetEngine.hpp"
+#include "AvrRatchetHal.hpp"
 
 #define EXT_CLOCK_IN    2 // This MUST be an intrerrupt enabled input; D2 ==> INT0
 #define EXT_RESET_MPU   3 // This MUST be an interrrupt enabled input; D3 ==> INT1
@@ -79,14 +122,121 @@
 #define OUT_HIGH true // Set to false when using an arduino output only. But if this is followed by a BJT, this must be inverted!
 #define OUT_LOW (!OUT_HIGH)
 
+// Write CLOCK_OUT (D5 = PD5) directly. This compiles into a single sbi or cbi instruction
+// which is a lot faster than digitalWrite and is used where output latency matters.
+inline void writeClockOut(bool state) {
+  if (state) {
+    PORTD |= _BV(PD5);
+  } else {
+    PORTD &= ~_BV(PD5);
+  }
+}
+
 // Define the number of rising clock signals on the ext clock input we use
-// to compute the cycle time (inversely related to bpm) of the clock.
-#define NR_OF_CYCLES 5
+// to compute the cycle time (inversely related to bpm) of the clock. Like POTMETER_SCAN_INTERVAL_TIME,
+// FOUR_BITS and SEVEN_BITS it may be defined before this file is included (tools/sweep.cpp does so).
+#ifndef NR_OF_CYCLES
+  #define NR_OF_CYCLES 5
+#endif
+
+// Do we want the brightness of the DIV and MULT leds to show the current division or multiplication factor?
+#define SHOW_FRACTION_AS_BRIGHTNESS
 
 // Do we want to reset estimating the cycle time, this will take #cycles clock pulses
 // each time we receive an external reset signal?
 //#define RESTART_CLOCK_SPEED_ESTIMATION_ON_RESET
 
+// Do we want the reset edge to be the first beat? If so, the output is set at the reset edge
+// (in MULT and MAX_MULT a new burst is started) using the last known factor. A clock pulse arriving
+// less than RESET_GUARD_FRACTION of a cycle after the reset is considered to belong to the same beat.
+// If not defined, a reset only cancels the burst and restarts counting at the next clock pulse.
+#define RESET_ALIGNS_OUTPUT
+#define RESET_GUARD_FRACTION 4 // i.e. 1/4 of the cycle time.
+
+// Do we want to handle input clocks into the kHz range (e.g. an oscillator)? When the measured
+// cycle time drops below HIGH_RATE_ENTER_CYCLE_TIME the module switches to a high rate mode in which:
+// - all ADC reads and random decisions are made in the main loop ahead of time,
+// - DIV counts clock edges in a minimal interrupt routine,
+// - MULT lets Timer1 run in CTC mode with precomputed compare values; its interrupt only toggles the output.
+// Above HIGH_RATE_LEAVE_CYCLE_TIME the normal mode is used again. See manual.txt for the supported frequencies.
+#define HIGH_RATE_MODE
+#define HIGH_RATE_ENTER_CYCLE_TIME 2500 // Time in microseconds (400 Hz).
+#define HIGH_RATE_LEAVE_CYCLE_TIME 3500 // Time in microseconds (~285 Hz).
+#define HIGH_RATE_CYCLES_SHIFT 4        // Average the cycle time over 2^HIGH_RATE_CYCLES_SHIFT edges.
+#define NR_OF_PREPARED_DECISIONS 32     // Must be a power of 2.
+
+// Do we want the length of every beat to follow a swung input clock? If so, repeating patterns of 2 or
+// 3 clock intervals (like long, short, long, short) are detected and every burst is sized to the interval
+// it will actually occupy instead of to the mean cycle time. Not used in high rate and RATIO mode.
+#define SWING_TRACKING
+#define NR_OF_PENDING_INTERVALS 4 // Must be a power of 2.
+
+// Do we want the ratchet bursts to be produced by the timer hardware? CLOCK_OUT (D5) is OC0B, the compare
+// output B of Timer0. If defined, Timer0 toggles D5 by itself for the whole burst and its interrupt only
+// counts edges, so edges are exact to the clock cycle whatever the interrupt load. Timer0 can then no longer
+// run millis() and micros(): millis() is counted by the Timer2 system tick and micros() is replaced by
+// getMicros() which reads Timer2. delay() must not be used after setup() has called initSystemTick().
+// Not used in high rate, predictive and RATIO mode.
+//#define HARDWARE_BURSTS
+
+// Do we want more than one output? If so, the ratchet engine produces CLOCK_OUT (channel 0, which follows
+// the front panel) and the channels in extraChannels[] on spare pins, all from Timer1. The pots and CV inputs
+// are then read by the main loop only. Timer1 can not be shared, so the high rate mode, predictive output and
+// hardware bursts can not be used. In RATIO mode only CLOCK_OUT is produced.
+//#define MULTI_CHANNEL
+#ifdef MULTI_CHANNEL
+  #undef HIGH_RATE_MODE // Defined by default, so MULTI_CHANNEL switches it off.
+#endif
+
+// Do we want to measure how long each interrupt routine blocks the others and print the
+// maximum values every ISR_TIMING_REPORT_INTERVAL_TIME mS?
+#ifdef DEBUG
+  #define REPORT_ISR_TIMING
+#endif
+#define ISR_TIMING_REPORT_INTERVAL_TIME 5000 // time in mS
+
+// Do we want the output to be scheduled against the predicted next clock edge instead of reacting
+// to the clock edge? The output then has no lag, but the pots and CV inputs are read one beat ahead.
+// When the input clock stops, FLYWHEEL_BEATS more beats are produced at the last tempo (at least 1
+// is needed to get output without lag). A clock edge arriving within 1/PREDICTION_WINDOW_FRACTION of
+// a beat after a predicted beat started confirms that beat, a later one starts the next beat early. With 2
+// every clock edge belongs to the predicted beat it is nearest to, so a late edge never starts a second beat.
+//#define PREDICTIVE_OUTPUT
+#define FLYWHEEL_BEATS 4
+#define PREDICTION_WINDOW_FRACTION 2
+#if defined(PREDICTIVE_OUTPUT) && defined(DEBUG)
+  #define REPORT_PREDICTION // Print statistics on confirmed beats, early clock edges and flywheel beats.
+#endif
+#if defined(MULTI_CHANNEL) && (defined(PREDICTIVE_OUTPUT) || defined(HARDWARE_BURSTS))
+  #error "MULTI_CHANNEL needs Timer1 for itself: undefine PREDICTIVE_OUTPUT and HARDWARE_BURSTS."
+#endif
+
+#ifdef HARDWARE_BURSTS
+// The millisecond counter of the Arduino core. Counted by the Timer2 system tick once Timer0 produces the bursts.
+extern "C" volatile unsigned long timer0_millis;
+volatile unsigned long systemMicrosBase = 0; // Time in microseconds of the last system tick.
+
+// micros() reads Timer0, which produces the bursts. This reads Timer2 instead, with the same 4 uS resolution.
+inline unsigned long getMicros() {
+  unsigned long base;
+  byte count;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    base = systemMicrosBase;
+    count = TCNT2;
+    if ((TIFR2 & _BV(OCF2A)) && (count < OCR2A)) { // Timer2 wrapped but the tick did not run yet.
+      base += 1000;
+    }
+  }
+  return(base + count * 4UL);
+}
+#else
+inline unsigned long getMicros() {
+  return(micros());
+}
+#endif
+
+#include "IsrStats.hpp" // Uses getMicros().
+
 OneButton button(TOGGLE_DIV_OR_MULT_MPU); // Button has pull up resistor and is LOW when pushed.
 
 #define INIT 0
@@ -94,10 +244,11 @@ OneButton button(TOGGLE_DIV_OR_MULT_MPU); // Button has pull up resistor and is
 #define ONE  2
 #define MULT 3
 #define MAX_MULT 4
+#define RATIO 5
 
-#define NR_OF_LED_MODES 5
+#define NR_OF_LED_MODES 6
 #ifdef DEBUG
-  String mode_str[NR_OF_LED_MODES] = { "INIT", "DIV", "ONE", "MULT", "MAX_MULT" };
+  String mode_str[NR_OF_LED_MODES] = { "INIT", "DIV", "ONE", "MULT", "MAX_MULT", "RATIO" };
 #endif
 
 #define INITIAL_MULT_MODE MULT
@@ -108,18 +259,30 @@ byte allLeds[NR_OF_LEDS] = { LED_DIV_MPU, LED_MULT_MPU, LED_ONE_MPU, LED_CHANCE_
 const byte NR_OF_TESTS = 2;
 
 #include "LedTester.hpp"
+#include "LedCompositor.hpp"
 #include "LedCluster.hpp"
 
 LedTester ledTester(allLeds);
 
-LedCluster ledCluster(LED_DIV_MPU, LED_MULT_MPU, LED_ONE_MPU);
+LedCompositor ledCompositor;
+
+LedCluster ledCluster(&ledCompositor, LED_DIV_MPU, LED_MULT_MPU, LED_ONE_MPU);
+
+byte ledChance = ledCompositor.addLed(LED_CHANCE_MPU);
 
 LFSR_RandomNumberGenerator *randomNumberGenerator;
 
+#ifdef REPORT_ISR_TIMING
+  IsrStats isrStats;
+  MillisDelay isrTimingReportDelay;
+#endif
+
 MillisDelay aliveDelay;
 #define BUILT_IN_LED_INTERVAL_TIME 500 // time in mS
 MillisDelay potmeterScanDelay;
-#define POTMETER_SCAN_INTERVAL_TIME 100 // time in mS
+#ifndef POTMETER_SCAN_INTERVAL_TIME
+  #define POTMETER_SCAN_INTERVAL_TIME 100 // time in mS
+#endif
 
 #define NR_OF_MULT_POT_VALUES 6
 byte potValues4Mult[NR_OF_MULT_POT_VALUES] = { 0, 1, 2, 3, 4, 5 };
@@ -127,10 +290,16 @@ byte potValues4Mult[NR_OF_MULT_POT_VALUES] = { 0, 1, 2, 3, 4, 5 };
 #define NR_OF_DIV_POT_VALUES 11
 byte potValues4Div[NR_OF_DIV_POT_VALUES] =  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 16 };
 
+// The ratios (output cycles : input cycles) for RATIO mode.
+#define NR_OF_RATIOS 13
+byte ratioNumerators[NR_OF_RATIOS]   = { 1, 1, 1, 2, 3, 1, 5, 4, 3, 2, 5, 3, 4 };
+byte ratioDenominators[NR_OF_RATIOS] = { 4, 3, 2, 3, 4, 1, 4, 3, 2, 1, 2, 1, 1 };
+#define RATIO_TICK_TIME 100 // Time in uS between two updates of the phase accumulator.
+
 int getFraction(int nrOfValues, byte potValues[]) {
   // nrOfValues will be 0 ... NR_OF_FRACTIONS - 1 or 0 ... NR_OF_MULT_POT_VALUES - 1
   int maxVal = max(analogRead(FREQ_POT_MPU), analogRead(FREQ_IN_MPU));
-  int index = map(maxVal, 0, 1024, 0, nrOfValues);
+  int index = potValueToIndex(maxVal, nrOfValues);
   //debug_print4("m: %d, i: %2d v:%2d\n", maxVal, index, potValues[index]);
   return(potValues[index]);
 }
@@ -138,16 +307,16 @@ int getFraction(int nrOfValues, byte potValues[]) {
 void getFraction(int nrOfValues, byte potValues[], byte *minValue, byte *maxValue) {
   // nrOfValues will be 0 ... NR_OF_FRACTIONS - 1 or 0 ... NR_OF_MULT_POT_VALUES - 1
   int minVal = analogRead(FREQ_POT_MPU);
-  int minIndex = map(minVal, 0, 1024, 0, nrOfValues);
+  int minIndex = potValueToIndex(minVal, nrOfValues);
   int maxVal = analogRead(FREQ_IN_MPU);
-  int maxIndex = map(maxVal, 0, 1024, 0, nrOfValues);
+  int maxIndex = potValueToIndex(maxVal, nrOfValues);
   *minValue = potValues[minIndex];
   *maxValue = potValues[maxIndex];
 }
 
 
 typedef struct SettingsObjType {
-  volatile byte device_mode; // Either DIV, MULT or MAX_MULT, but never ONE.
+  volatile byte device_mode; // Either DIV, MULT, MAX_MULT or RATIO, but never ONE.
   volatile byte dummy[3];    // Add dummy bytes until total size of struct is integer multiple of sizeof(MARKER)
 } SettingsObjType_t ;
 
@@ -156,26 +325,50 @@ SettingsObjType_t settings;
 #include <EEPROM.h>
 #include "Eeprom.hpp"
 
-#define FOUR_BITS 4
+#ifndef FOUR_BITS
+  #define FOUR_BITS 4
+#endif
 
 Eeprom eeprom;
 
+// The fraction for each mode. The mode is a template parameter so that every
+// mode gets its own function without any tests on the mode at run time.
+template <byte MODE> int getModeFraction() {
+  // INIT and ONE are never used as device mode.
+  return(0);
+}
+
+template <> int getModeFraction<MULT>() {
+  return(getFraction(NR_OF_MULT_POT_VALUES, potValues4Mult));
+}
+
+template <> int getModeFraction<MAX_MULT>() {
+  byte minValue, maxValue;
+  // Use the pot for the lower limit and the CV-value for the upper limit.
+  getFraction(NR_OF_MULT_POT_VALUES, potValues4Mult, &minValue, &maxValue);
+  // We limit frac to a range from 1 ... maxFrac.
+  return(randomNumberGenerator->getRandomNumber(minValue, maxValue + 1, FOUR_BITS));
+}
+
+template <> int getModeFraction<DIV>() {
+  return(getFraction(NR_OF_DIV_POT_VALUES, potValues4Div));
+}
+
+// In RATIO mode the fraction is an index into the ratio table.
+template <> int getModeFraction<RATIO>() {
+  int maxVal = max(analogRead(FREQ_POT_MPU), analogRead(FREQ_IN_MPU));
+  return(potValueToIndex(maxVal, NR_OF_RATIOS));
+}
+
+typedef int (*FractionGetter)(void);
+
+const FractionGetter fractionGetters[NR_OF_LED_MODES] = {
+  getModeFraction<INIT>, getModeFraction<DIV>, getModeFraction<ONE>, getModeFraction<MULT>, getModeFraction<MAX_MULT>,
+  getModeFraction<RATIO>
+};
+
 int getFraction() {
-    int frac;
-    if (settings.device_mode == MULT) {
-      frac = getFraction(NR_OF_MULT_POT_VALUES, potValues4Mult);
-    } else {
-      byte minValue, maxValue;
-      if (settings.device_mode == MAX_MULT) {
-        // Use the pot for the lower limit and the CV-value for the upper limit.
-        getFraction(NR_OF_MULT_POT_VALUES, potValues4Mult, &minValue, &maxValue);
-        // We limit frac to a range from 1 ... maxFrac.
-        frac = randomNumberGenerator->getRandomNumber(minValue, maxValue + 1, FOUR_BITS);
-      } else { // mode must be DIV
-        frac = getFraction(NR_OF_DIV_POT_VALUES, potValues4Div);
-      }
-    }
-    return(frac);
+  return(fractionGetters[settings.device_mode]());
 }
 
 int getChanceValue(int nrOfValues) {
@@ -197,10 +390,17 @@ volatile unsigned int newPeriodTime;
 volatile bool outState = OUT_HIGH;
 volatile int frac = 2;
 volatile byte irqCnt = 0;
-volatile unsigned long oldTime = micros();
+volatile byte burstPulses = 1; // The number of gates in the running burst.
+volatile unsigned long oldTime = getMicros();
 volatile unsigned long thisTime;
 volatile unsigned long sumTime = 0L;
 volatile byte irqCounter = 0;
+volatile unsigned long resetTime;
+volatile bool resetBeatPending = false;
+volatile bool resetOdds = true; // The chance decision for the next reset beat, drawn by the main loop.
+#ifdef HIGH_RATE_MODE
+  volatile bool highRate = false;
+#endif
 #ifdef DEBUG
   volatile bool led_builtin_state = true;
 #endif
@@ -208,121 +408,1543 @@ volatile byte irqCounter = 0;
 #define MIN_CHANCE_LEVEL 0
 #define MAX_CHANCE_LEVEL 100
 
-#define SEVEN_BITS 7
+#ifndef SEVEN_BITS
+  #define SEVEN_BITS 7
+#endif
 
-bool oddsInFavour() {
+bool drawChance() {
   // We want the chance level to increase when turning the potentiometer to the right.
   int chanceLevel = getChanceValue(100);
-  if (randomNumberGenerator->getRandomNumber(MIN_CHANCE_LEVEL, MAX_CHANCE_LEVEL, SEVEN_BITS) < chanceLevel) {
-    digitalWrite(LED_CHANCE_MPU, LED_ON);
+  return(randomNumberGenerator->getRandomNumber(MIN_CHANCE_LEVEL, MAX_CHANCE_LEVEL, SEVEN_BITS) < chanceLevel);
+}
+
+bool oddsInFavour() {
+  if (drawChance()) {
+    ledCompositor.setState(ledChance, LED_ON);
     return(true);
   } else {
-    digitalWrite(LED_CHANCE_MPU, LED_OFF);
+    ledCompositor.setState(ledChance, LED_OFF);
     return(false);
   }
 }
 
 void timerInterrupt() {
+  #ifdef REPORT_ISR_TIMING
+    unsigned long isrStart = isrStats.start();
+  #endif
   irqCnt++;
-  digitalWrite(CLOCK_OUT, outState);
+  writeClockOut(outState);
   outState = !outState;
-  if (irqCnt > (2 * frac)) {
+  if (irqCnt > (2 * burstPulses)) {
     Timer1.stop();
   }
+  #ifdef REPORT_ISR_TIMING
+    isrStats.stop(ISR_RATCHET, isrStart);
+  #endif
 }
 
-void clockISR() { // Will respond to a rising edge on INT0
-  Timer1.stop();
+//
+// Deferred work. The interrupt routines of the clock and reset inputs (the top halves) only
+// latch the time, cancel a running burst and set the output if its value is already known.
+// Everything else (computing the cycle time, reading the ADC, drawing random numbers and
+// programming Timer1) is done by the bottom half. It runs from the Timer2 compare B interrupt
+// with interrupts enabled, so it can be interrupted by the ratchet timer, the millis() tick
+// and the clock and reset inputs.
+//
+
+#define WORK_TEMPO 0x01 // A new cycle time has to be computed.
+#define WORK_CLOCK 0x02 // The output for a clock edge has to be determined.
+#define WORK_RESET 0x04 // The output for a reset edge has to be determined.
+#define WORK_INTERVAL 0x10 // New clock intervals have to be added to the swing tracker.
+#define WORK_PREPARE 0x20 // The output for the next clock edge has to be prepared.
+
+volatile byte pendingWork = 0;
+volatile bool bottomHalfRunning = false;
+volatile unsigned long pendingSumTime;
+volatile byte pendingIrqCounter;
+
+#ifdef SWING_TRACKING
+  SwingTracker swingTracker;
+  // Clock intervals on their way from the top halves to the swing tracker.
+  volatile unsigned long pendingIntervals[NR_OF_PENDING_INTERVALS];
+  volatile byte intervalHead = 0; // Written by the top halves only.
+  volatile byte intervalTail = 0; // Written by the bottom half only.
+
+  // Must be called with interrupts disabled, i.e. from a top half.
+  inline void pushInterval(unsigned long interval) {
+    byte nextHead = (intervalHead + 1) & (NR_OF_PENDING_INTERVALS - 1);
+    if (nextHead != intervalTail) { // If the bottom half lags this far behind, the interval is lost.
+      pendingIntervals[intervalHead] = interval;
+      intervalHead = nextHead;
+    }
+  }
+
+  // Feed the pending intervals to the swing tracker. Called from the bottom half.
+  void drainIntervals() {
+    while (true) {
+      unsigned long interval;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (intervalTail == intervalHead) {
+          return;
+        }
+        interval = pendingIntervals[intervalTail];
+        intervalTail = (intervalTail + 1) & (NR_OF_PENDING_INTERVALS - 1);
+      }
+      swingTracker.addInterval(interval);
+    }
+  }
+#endif
+
+// The expected length of the beat which starts stepsAhead clock pulses after the last clock pulse.
+// Called from the bottom half.
+inline unsigned long getBeatTime(byte stepsAhead = 0) {
+  #ifdef SWING_TRACKING
+    if (swingTracker.isStarted()) {
+      return(swingTracker.getInterval(stepsAhead));
+    }
+  #endif
+  return(cycleTime);
+}
+
+// Must be called with interrupts disabled, i.e. from a top half.
+inline void pendBottomHalf(byte work) {
+  pendingWork |= work;
+  // Let the compare B interrupt of Timer2 fire 2 counts (8 uS) from now.
+  byte next = TCNT2 + 2;
+  if (next > OCR2A) {
+    next -= OCR2A + 1;
+  }
+  OCR2B = next;
+  TIFR2 = _BV(OCF2B);
+  TIMSK2 |= _BV(OCIE2B);
+}
+
+#ifdef HARDWARE_BURSTS
+//
+// Hardware bursts. During a burst Timer0 runs in CTC mode and toggles OC0B (D5) on every compare B match.
+// A half period longer than Timer0 can count is split into burstSubPeriods Timer0 periods, the last
+// burstLongSubPeriods of which count once more to make up for the remainder of the split, and
+// compare B can only match (OCR0B == OCR0A) in the last of them. The compare A interrupt only counts
+// periods and edges. When the burst ends or is cancelled, the level of D5 is copied into PORTD before
+// OC0B is disconnected, so writeClockOut() takes over without a glitch.
+//
+
+volatile byte burstEdgesLeft = 0;  // Edges left to be produced by Timer0.
+volatile byte burstSubPeriods = 1; // Timer0 periods per half period of the burst.
+volatile byte burstSubPeriodsLeft; // Timer0 periods left in this half period.
+volatile byte burstLongSubPeriods = 0; // The last ones of a half period count burstTop + 1.
+volatile byte burstTop;
+
+// Timer0 prescalers as clock select bits, and log2 of their division factor.
+const byte timer0ClockSelects[] = { _BV(CS00), _BV(CS01), _BV(CS01) | _BV(CS00), _BV(CS02), _BV(CS02) | _BV(CS00) };
+const byte timer0PrescaleShifts[] = { 0, 3, 6, 8, 10 };
+
+// Must be called with interrupts disabled.
+inline void stopHardwareBurst() {
+  TCCR0B = 0; // Stop Timer0.
+  TIFR0 = _BV(OCF0A);
+  burstEdgesLeft = 0;
+  if (TCCR0A & _BV(COM0B0)) {
+    // Hand D5 back to PORTD at the level Timer0 left it.
+    writeClockOut(PIND & _BV(PD5));
+    TCCR0A = _BV(WGM01);
+  }
+}
+
+// Set the top of the Timer0 period which starts now, and let compare B match only in the last one.
+inline void setBurstSubPeriod() {
+  byte top = burstTop + ((burstSubPeriodsLeft <= burstLongSubPeriods) ? 1 : 0);
+  OCR0A = top;
+  OCR0B = (burstSubPeriodsLeft == 1) ? top : 0xFF;
+}
+
+// Let Timer0 produce a burst of pulses, starting with an OUT_HIGH output now.
+// Must be called with interrupts disabled.
+inline void startHardwareBurst(unsigned long halfPeriodTime, byte pulses) {
+  stopHardwareBurst();
+  unsigned long counts = 0;
+  byte index;
+  for (index = 0; index < sizeof(timer0PrescaleShifts); index++) {
+    counts = (halfPeriodTime * clockCyclesPerMicrosecond()) >> timer0PrescaleShifts[index];
+    if (counts <= 0x100UL) {
+      break;
+    }
+  }
+  byte subPeriods = 1;
+  byte longSubPeriods = 0;
+  if (index == sizeof(timer0PrescaleShifts)) { // Longer than Timer0 can count, split the half period.
+    index--;
+    subPeriods = min((counts + 254) / 255, 255UL); // So that OCR0A stays below 0xFF.
+    // With a remainder counts / subPeriods is at most 254, so the long periods stay below 0xFF too.
+    longSubPeriods = counts % subPeriods;
+    counts /= subPeriods;
+  }
+  if (counts == 0) {
+    counts = 1;
+  }
+  burstTop = counts - 1;
+  burstSubPeriods = subPeriods;
+  burstSubPeriodsLeft = subPeriods;
+  burstLongSubPeriods = longSubPeriods;
+  setBurstSubPeriod();
+  TCNT0 = 0;
+  // Force OC0B to OUT_HIGH while connecting it to D5 (set or clear on match), then let it toggle on every
+  // compare B match.
+  TCCR0A = _BV(WGM01) | _BV(COM0B1) | (OUT_HIGH ? _BV(COM0B0) : 0);
+  TCCR0B = _BV(FOC0B);
+  TCCR0A = _BV(WGM01) | _BV(COM0B0);
+  burstEdgesLeft = 2 * pulses - 1;
+  TIFR0 = _BV(OCF0A);
+  TIMSK0 = _BV(OCIE0A);
+  TCCR0B = timer0ClockSelects[index];
+}
+
+ISR(TIMER0_COMPA_vect) {
+  #ifdef REPORT_ISR_TIMING
+    unsigned long isrStart = isrStats.start();
+  #endif
+  if (burstEdgesLeft != 0) {
+    if (--burstSubPeriodsLeft == 0) { // Timer0 produced an edge at this compare match.
+      burstSubPeriodsLeft = burstSubPeriods;
+      if (--burstEdgesLeft == 0) {
+        stopHardwareBurst();
+      }
+    }
+    setBurstSubPeriod();
+  }
+  #ifdef REPORT_ISR_TIMING
+    isrStats.stop(ISR_RATCHET, isrStart);
+  #endif
+}
+
+// Take Timer0 from the Arduino core. From here on millis() is counted by the system tick.
+void initBurstTimer() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    TIMSK0 = 0; // No more millis() and micros() from Timer0.
+    TCCR0B = 0;
+    TCCR0A = _BV(WGM01);
+    systemMicrosBase = timer0_millis * 1000UL;
+  }
+}
+#endif
+
+// Cancel a running burst. Must be called with interrupts disabled.
+inline void stopBurst() {
+  #ifdef HARDWARE_BURSTS
+    stopHardwareBurst();
+  #else
+    Timer1.stop();
+  #endif
+}
+
+// Start a burst of pulses with half periods of periodTime. The output must already be set high.
+// Called from the bottom half.
+inline void startBurst(unsigned long periodTime, byte pulses) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // If a newer clock or reset edge arrived meanwhile, this burst is out of date.
+    if (pendingWork & (WORK_CLOCK | WORK_RESET)) {
+      return;
+    }
+    #ifdef HARDWARE_BURSTS
+      startHardwareBurst(periodTime, pulses);
+    #else
+      irqCnt = 0;
+      burstPulses = pulses;
+      // The period time will be in micro seconds.
+      Timer1.setPeriod(periodTime);
+      Timer1.start();
+    #endif
+  }
+}
+
+// clockISR() sets the output at the clock edge to a level the bottom half prepared from the last
+// known frac, the DIV count and the chance and MAX_MULT count drawn in advance. The predictive and
+// multi-channel clock handlers decide their beats themselves.
+#if !defined(PREDICTIVE_OUTPUT) && !defined(MULTI_CHANNEL)
+  #define PREPARE_CLOCK_EDGE
+#endif
+
+volatile bool nextClockLevel = OUT_LOW; // The output level clockISR() sets at the next clock edge.
+bool nextOdds = false;                  // The chance draw for the next beat in DIV mode.
+byte nextCount = 0;                     // The number of gates for the next beat in MAX_MULT mode.
+
+// Prepare the output for the next clock edge. Called by the bottom half after every clock and reset
+// edge, and after the main loop has scanned the pots (so a turned knob is followed without a clock).
+// The draws are made here, so the bottom half of the clock edge uses them instead of drawing itself.
+template <byte MODE> void prepareClockEdge() {
+  #ifdef HIGH_RATE_MODE
+    if (highRate) { // The main loop prepares the decisions in high rate mode.
+      return;
+    }
+  #endif
+  bool level = (frac == 0) ? OUT_LOW : OUT_HIGH;
+  if (MODE == MAX_MULT) {
+    nextCount = getModeFraction<MAX_MULT>();
+    level = (nextCount == 0) ? OUT_LOW : OUT_HIGH;
+  } else if (MODE == DIV) {
+    nextOdds = drawChance();
+    if (frac > 1) {
+      level = (nextOdds && (irqCnt + 1 >= frac)) ? OUT_HIGH : OUT_LOW;
+    }
+  }
+  nextClockLevel = level;
+}
+
+// The top half of the clock edge handling which is the same for all modes.
+// Will respond to a rising edge on INT0. It runs a fixed sequence of instructions (no loops, no
+// ADC reads), so the output follows the clock edge after at most the interrupt response time, plus
+// the longest routine that runs with interrupts disabled (the isr max figures of REPORT_ISR_TIMING
+// for clock, reset, ratchet and led tick), plus this routine up to writeClockOut(). See manual.txt.
+void clockISR() {
+  #ifdef REPORT_ISR_TIMING
+    unsigned long isrStart = isrStats.start();
+  #endif
   // We measure the cycle time in MICRO seconds.
-  thisTime = micros();
+  thisTime = getMicros();
   // If there is an IRQ from INT0, then increment the counter.
   irqCounter++;
-  sumTime += thisTime - oldTime;
+  unsigned long interval = thisTime - oldTime;
+  sumTime += interval;
   oldTime = thisTime;
   // We use the mean of several inter interrupt times as the cycle time.
+  // The division is left to the bottom half.
+  byte work = WORK_CLOCK;
+  #ifdef SWING_TRACKING
+    pushInterval(interval);
+    work |= WORK_INTERVAL;
+  #endif
   if (irqCounter > NR_OF_CYCLES) {
-    cycleTime = sumTime / irqCounter;
+    pendingSumTime = sumTime;
+    pendingIrqCounter = irqCounter;
     irqCounter = 0;
     sumTime = 0;
+    work |= WORK_TEMPO;
   }
 
+  #ifdef RESET_ALIGNS_OUTPUT
+    if (resetBeatPending) {
+      resetBeatPending = false;
+      if ((thisTime - resetTime) < (cycleTime / RESET_GUARD_FRACTION)) {
+        // This clock pulse belongs to the beat which was already started by the reset,
+        // so it is only used to estimate the cycle time. The burst started by the reset keeps running.
+        work &= ~WORK_CLOCK;
+      }
+    }
+  #endif
+
+  if (work & WORK_CLOCK) {
+    // Cancel the burst of the previous beat if it is still running.
+    stopBurst();
+    // Set the output right away. The bottom half starts the burst and only corrects the
+    // output when the knobs or CV inputs changed since the level was prepared.
+    writeClockOut(nextClockLevel);
+    outState = nextClockLevel;
+    // This edge supersedes a reset edge which has not been handled yet.
+    pendingWork &= ~WORK_RESET;
+  }
+  pendBottomHalf(work);
+  #ifdef REPORT_ISR_TIMING
+    isrStats.stop(ISR_CLOCK, isrStart);
+  #endif
+}
+
+// The bottom half of the clock edge handling for each mode.
+// All tests on MODE are resolved by the compiler.
+template <byte MODE> void clockBottomHalf() {
   #ifdef DEBUG
     digitalWrite(LED_BUILTIN, led_builtin_state);
     led_builtin_state = !led_builtin_state;
   #endif
 
-  frac = getFraction();
+  if (MODE == MAX_MULT) {
+    // The count was drawn in advance, clockISR() has set the output for it.
+    frac = nextCount;
+  } else {
+    frac = getModeFraction<MODE>();
+  }
   // debug_print2("%d ", frac);
   if (frac == 0) {
     // No gate is send. The odds are of no importance, so the led is turned off.
-    digitalWrite(CLOCK_OUT, OUT_LOW);
+    writeClockOut(OUT_LOW);
+    return;
+  }
+  if ((frac == 1) || (MODE != DIV)) {
+    // We start with a high output.
+    writeClockOut(OUT_HIGH);
+    // The next state will be LOW.
+    outState = OUT_HIGH;
+  }
+  // The burst fills the interval up to the next clock pulse, which differs from the mean with a swung clock.
+  unsigned long beatTime = getBeatTime();
+  if (frac == 1) { // We pass the clock pulse unchanged.
+    startBurst(beatTime / 2, 1);
+  } else if (MODE == MAX_MULT) {
+    // We are multiplying the clock frequency of the 1st clock signal by starting
+    // a fast timer and counting its cycles until we have seen enough.
+    startBurst(beatTime / 2 / frac, frac);
+  } else if (MODE == MULT) {
+    // If the chance level is higher than some probability value then the odds are in
+    // favour of ratcheting (producing more than 1 output gate during this clock cycle).
+    if (oddsInFavour()) { // Yes, we can ratchet!
+      startBurst(beatTime / 2 / frac, frac);
+    } else {
+      startBurst(beatTime / 2, 1);
+    }
+  } else if (MODE == DIV) {
+    // We are counting external clock pulses to divide their frequency.
+    irqCnt++;
+    // We leave it up to chance whether we divide or not.
+    // If the chance level is higher than some probability number, then the odds are in
+    // favour of producing an output gate. They were drawn in advance, so clockISR() has set
+    // the output already unless frac changed.
+    ledCompositor.setState(ledChance, nextOdds ? LED_ON : LED_OFF);
+    if (nextOdds && (irqCnt >= frac)) {
+      irqCnt = 0;
+      outState = OUT_HIGH;
+      writeClockOut(OUT_HIGH);
+    } else {
+      writeClockOut(OUT_LOW);
+    }
+  }
+}
+
+//
+// RATIO mode. The output runs at p/q times the frequency of the input clock, for any p:q from the
+// ratio table. A 32 bit phase accumulator is advanced by phaseStep on every tick of Timer1 (every
+// RATIO_TICK_TIME uS) and the output is high during the first half of each of its cycles. The bottom
+// half computes the phase step from the measured cycle time; it takes effect together with p and q
+// at the next synchronisation. Every q input clock pulses the accumulator is synchronised to the clock,
+// and no more than p output cycles are produced between two of these moments, so the output is phase
+// locked to the input and does not drift.
+//
+
+volatile uint32_t phase = 0;
+volatile uint32_t phaseStep = 0;
+volatile byte ratioP = 1;          // Output cycles ...
+volatile byte ratioQ = 1;          // ... per this number of input cycles.
+volatile byte ratioCyclesDone = 0; // Output cycles started since the last synchronisation.
+volatile byte ratioBeat = 0;       // Input clock pulses since the last synchronisation.
+volatile bool ratioRunning = false;
+// Prepared by the bottom half, used from the next synchronisation on.
+volatile byte nextRatioP = 1;
+volatile byte nextRatioQ = 1;
+volatile uint32_t nextPhaseStep = 0;
+volatile bool ratioTimerActive = false;
+
+// Must be called with interrupts disabled.
+inline void synchroniseRatio() {
+  ratioP = nextRatioP;
+  ratioQ = nextRatioQ;
+  phaseStep = nextPhaseStep;
+  ratioBeat = 0;
+  ratioCyclesDone = 1;
+  phase = 0;
+  ratioRunning = true;
+  writeClockOut(OUT_HIGH);
+}
+
+ISR(TIMER1_COMPB_vect) { // The ratio tick.
+  if (ratioRunning) {
+    uint32_t somePhase = phase + phaseStep;
+    if (somePhase < phaseStep) { // The accumulator wrapped, a new output cycle begins.
+      if (ratioCyclesDone >= ratioP) {
+        // All output cycles have been produced, wait for the next synchronisation.
+        ratioRunning = false;
+        return;
+      }
+      ratioCyclesDone++;
+      writeClockOut(OUT_HIGH);
+    } else if ((somePhase ^ phase) & 0x80000000UL) { // Halfway the output cycle.
+      writeClockOut(OUT_LOW);
+    }
+    phase = somePhase;
+  }
+}
+
+// Set up Timer1 to generate the ratio tick in CTC mode.
+void initRatioTimer() {
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12); // CTC mode, stopped.
+  TCNT1 = 0;
+  OCR1A = RATIO_TICK_TIME * clockCyclesPerMicrosecond() / 8 - 1;
+  OCR1B = 0;
+  TIMSK1 = _BV(OCIE1B);
+  TCCR1B = _BV(WGM12) | _BV(CS11); // Prescaler 8.
+}
+
+// The top half of the clock edge handling in RATIO mode. Will respond to a rising edge on INT0.
+void clockISRRatio() {
+  #ifdef REPORT_ISR_TIMING
+    unsigned long isrStart = isrStats.start();
+  #endif
+  thisTime = getMicros();
+  irqCounter++;
+  sumTime += thisTime - oldTime;
+  oldTime = thisTime;
+  byte work = WORK_CLOCK;
+  if (irqCounter > NR_OF_CYCLES) {
+    pendingSumTime = sumTime;
+    pendingIrqCounter = irqCounter;
+    irqCounter = 0;
+    sumTime = 0;
+    work |= WORK_TEMPO;
+  }
+  if (++ratioBeat >= ratioQ) {
+    synchroniseRatio();
+  }
+  pendBottomHalf(work);
+  #ifdef REPORT_ISR_TIMING
+    isrStats.stop(ISR_CLOCK, isrStart);
+  #endif
+}
+
+// The bottom half in RATIO mode. Reads the ratio from the pot and CV input and computes the phase step.
+template <> void clockBottomHalf<RATIO>() {
+  #ifdef DEBUG
+    digitalWrite(LED_BUILTIN, led_builtin_state);
+    led_builtin_state = !led_builtin_state;
+  #endif
+  frac = getModeFraction<RATIO>();
+  byte p = ratioNumerators[frac];
+  byte q = ratioDenominators[frac];
+  unsigned long someCycleTime;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    someCycleTime = cycleTime;
+  }
+  // The ticks in a window of q input cycles, during which p output cycles are produced.
+  unsigned long ticksPerWindow = (someCycleTime / RATIO_TICK_TIME) * q;
+  // An output cycle takes at least two ticks, one high and one low.
+  if (ticksPerWindow < 2UL * p) {
+    ticksPerWindow = 2UL * p;
+  }
+  // The phase step for p output cycles during q input cycles.
+  uint32_t step = (0xFFFFFFFFUL / ticksPerWindow) * p;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    nextRatioP = p;
+    nextRatioQ = q;
+    nextPhaseStep = step;
+  }
+}
+
+typedef void (*ClockHandler)(void);
+
+// Adding a mode only requires adding its bottom half to this table.
+const ClockHandler clockBottomHalves[NR_OF_LED_MODES] = {
+  clockBottomHalf<INIT>, clockBottomHalf<DIV>, clockBottomHalf<ONE>, clockBottomHalf<MULT>, clockBottomHalf<MAX_MULT>,
+  clockBottomHalf<RATIO>
+};
+
+volatile ClockHandler activeClockBottomHalf = clockBottomHalf<MULT>;
+
+#ifdef PREPARE_CLOCK_EDGE
+const ClockHandler clockEdgePreparers[NR_OF_LED_MODES] = {
+  prepareClockEdge<INIT>, prepareClockEdge<DIV>, prepareClockEdge<ONE>, prepareClockEdge<MULT>, prepareClockEdge<MAX_MULT>,
+  prepareClockEdge<RATIO>
+};
+
+volatile ClockHandler activeClockEdgePreparer = prepareClockEdge<MULT>;
+
+// Let the bottom half prepare the next clock edge again, e.g. because the knobs were scanned.
+void requestClockEdgePreparation() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    pendBottomHalf(WORK_PREPARE);
+  }
+}
+#endif
+
+#ifdef PREDICTIVE_OUTPUT
+//
+// Predictive output. Every beat is decided one beat in advance by the bottom half, including
+// the Timer1 settings needed to produce it. Timer1 (in CTC mode) produces the pulses of a beat
+// and, at the end of the beat, i.e. at the predicted time of the next clock edge, starts the
+// next beat by itself. So the output does not lag the input clock. A clock edge that arrives
+// shortly after a predicted beat started confirms that beat and re-anchors the prediction.
+// A clock edge that arrives before the predicted time starts the prepared beat at once, with
+// Timer1 settings prepared for a beat that starts at a clock edge.
+// When the input clock stops, FLYWHEEL_BEATS beats are produced at the last tempo.
+//
+
+#define WORK_RETIME 0x08 // The timing of the next beat has to be recomputed.
+
+// The beat which is running.
+volatile byte beatCountDown;       // Compare interrupts left in this beat; the last one ends the beat.
+volatile bool beatToggles;         // Does the output toggle during this beat?
+volatile bool beatRunning = false;
+volatile bool beatConfirmed = true; // Has this beat been matched to a clock (or reset) edge?
+volatile unsigned long beatStartTime;
+volatile unsigned long beatEndTime;
+volatile unsigned long beatConfirmTime; // A clock edge this long after the start confirms the beat.
+volatile byte beatNumber = 0;           // Counts the started beats, so a preparation can tell it is out of date.
+// The next beat as prepared by the bottom half.
+volatile byte nextBeatPulses = 1;
+volatile bool nextBeatToggles = false;
+volatile bool nextBeatLevel = OUT_LOW;
+volatile uint16_t nextBeatTop = 0xFFFF;
+volatile byte nextBeatClockSelect = _BV(CS12);
+volatile unsigned long nextBeatDuration = 750000L;
+// The Timer1 settings for the next beat when a clock (or reset) edge starts it instead of Timer1.
+volatile uint16_t nextEdgeBeatTop = 0xFFFF;
+volatile byte nextEdgeBeatClockSelect = _BV(CS12);
+volatile unsigned long nextEdgeBeatDuration = 750000L;
+// The time of the last clock edge. Predicted clock edges are multiples of cycleTime from here.
+volatile unsigned long anchorTime;
+volatile byte flywheelBeatsLeft = 0;
+
+#ifdef REPORT_PREDICTION
+  // A confirmed beat was started by prediction and its clock edge arrived shortly after it (clock lag).
+  // An early clock edge arrived before the predicted time of its beat and started the beat itself
+  // (clock lead). These are debug counters, not a benchmark of the prediction.
+  volatile unsigned int nrOfConfirmedBeats = 0;
+  volatile unsigned int nrOfEarlyClockEdges = 0;
+  volatile unsigned int nrOfFlywheelBeats = 0;
+  volatile unsigned long maxClockLagTime = 0;
+  volatile unsigned long maxClockLeadTime = 0;
+#endif
+
+// Timer1 prescalers as clock select bits, and log2 of their division factor.
+const byte timer1ClockSelects[] = { _BV(CS10), _BV(CS11), _BV(CS11) | _BV(CS10), _BV(CS12), _BV(CS12) | _BV(CS10) };
+const byte timer1PrescaleShifts[] = { 0, 3, 6, 8, 10 };
+
+// Find the smallest Timer1 prescaler for which timeInMicroSeconds fits in the 16 bit compare register.
+// Returns the time Timer1 will actually produce.
+unsigned long computeTimerSetting(unsigned long timeInMicroSeconds, uint16_t *top, byte *clockSelect) {
+  unsigned long counts = 0;
+  byte index;
+  for (index = 0; index < sizeof(timer1PrescaleShifts); index++) {
+    counts = (timeInMicroSeconds * clockCyclesPerMicrosecond()) >> timer1PrescaleShifts[index];
+    if (counts <= 0x10000UL) {
+      break;
+    }
+  }
+  if (index == sizeof(timer1PrescaleShifts)) { // Longer than Timer1 can do, use the longest time possible.
+    index--;
+    counts = 0x10000UL;
+  }
+  if (counts == 0) {
+    counts = 1;
+  }
+  *top = counts - 1;
+  *clockSelect = timer1ClockSelects[index];
+  return((counts << timer1PrescaleShifts[index]) / clockCyclesPerMicrosecond());
+}
+
+// Start the prepared beat with the given Timer1 settings. Must be called with interrupts disabled.
+inline void startNextBeat(unsigned long startTime, uint16_t top, byte clockSelect, unsigned long duration) {
+  writeClockOut(nextBeatLevel);
+  TCCR1B = _BV(WGM12); // Stop the timer.
+  TCNT1 = 0;
+  OCR1A = top;
+  TIFR1 = _BV(OCF1A);
+  TCCR1B = _BV(WGM12) | clockSelect;
+  beatToggles = nextBeatToggles;
+  beatCountDown = 2 * nextBeatPulses;
+  beatStartTime = startTime;
+  beatEndTime = startTime + duration;
+  beatRunning = true;
+  beatNumber++;
+  // Let the bottom half prepare the beat after this one.
+  pendBottomHalf(WORK_CLOCK);
+}
+
+inline void stopBeats() {
+  TCCR1B = _BV(WGM12);
+  beatRunning = false;
+}
+
+// Called from the Timer1 compare interrupt.
+inline void predictiveTimerInterrupt() {
+  if (--beatCountDown != 0) {
+    if (beatToggles) {
+      PIND = _BV(PD5); // Writing a 1 to the PIN register toggles CLOCK_OUT.
+    }
+  } else if (flywheelBeatsLeft > 0) {
+    // This is the predicted time of the next clock edge.
+    flywheelBeatsLeft--;
+    #ifdef REPORT_PREDICTION
+      if (!beatConfirmed) {
+        nrOfFlywheelBeats++; // The previous beat was never confirmed by a clock edge.
+      }
+    #endif
+    beatConfirmed = false;
+    beatConfirmTime = nextBeatDuration / PREDICTION_WINDOW_FRACTION;
+    startNextBeat(beatEndTime, nextBeatTop, nextBeatClockSelect, nextBeatDuration);
   } else {
-    if (frac == 1) { // We pass the clock pulse unchanged.
-        irqCnt = 0;
-        // The period time will be in micro seconds.
-        Timer1.setPeriod(cycleTime / 2);
-        Timer1.start();
-        // We start with a high output.
-        digitalWrite(CLOCK_OUT, OUT_HIGH);
-        // The next state will be LOW.
-        outState = OUT_HIGH;
-    } else { // For all values of frac > 1
-      if (settings.device_mode != DIV) { // We are in MULT or MAX_MULT mode
-        // We are multiplying the clock frequency of the 1st clock signal by starting
-        // a fast timer and counting its cycles until we have seen enough. The clock may
-        // be multiplied by a factor of 1 or higher.
-        irqCnt = 0;
-        // We start with a high output.
-        digitalWrite(CLOCK_OUT, OUT_HIGH);
-        // The next state will be LOW.
-        outState = OUT_HIGH;
-        // If the chance level is higher than some probability value then the odds are in
-        // favour of ratcheting (producing more than 1 output gate during this clock cycle).
-        if (settings.device_mode == MAX_MULT) {
-          Timer1.setPeriod(cycleTime / 2 / frac);
-        } else {
-          if (oddsInFavour()) { // Yes, we can ratchet!
-            Timer1.setPeriod(cycleTime / 2 / frac);
-          } else {
-            Timer1.setPeriod(cycleTime / 2);
-          }
-        }
-        // The period time will be in micro seconds.
-        Timer1.start();
-      } else { // We are in DIV mode.
-        // We are counting external clock pulses to divide their frequency.
-        irqCnt++;
-        // We leave it up to chance whether we divide or not.
-        // If the chance level is higher than some probability number, then the odds are in
-        // favour of producing an output gate.
-        if (oddsInFavour()) {
-          if (irqCnt >= frac) {
-            irqCnt = 0;
-            outState = OUT_HIGH;
-            digitalWrite(CLOCK_OUT, OUT_HIGH);
-            return;
-          }
+    // The input clock has stopped.
+    stopBeats();
+    writeClockOut(OUT_LOW);
+  }
+}
+
+// The top half of the clock edge handling when the output is predicted.
+// Will respond to a rising edge on INT0.
+void clockISRPredictive() {
+  #ifdef REPORT_ISR_TIMING
+    unsigned long isrStart = isrStats.start();
+  #endif
+  thisTime = getMicros();
+  irqCounter++;
+  unsigned long interval = thisTime - oldTime;
+  sumTime += interval;
+  oldTime = thisTime;
+  byte work = 0;
+  #ifdef SWING_TRACKING
+    pushInterval(interval);
+    work |= WORK_INTERVAL;
+  #endif
+  if (irqCounter > NR_OF_CYCLES) {
+    pendingSumTime = sumTime;
+    pendingIrqCounter = irqCounter;
+    irqCounter = 0;
+    sumTime = 0;
+    work |= WORK_TEMPO;
+  }
+  anchorTime = thisTime;
+  flywheelBeatsLeft = FLYWHEEL_BEATS;
+  unsigned long sinceBeatStart = thisTime - beatStartTime;
+  if (beatRunning && !beatConfirmed && (sinceBeatStart < beatConfirmTime)) {
+    // The beat was started in advance (by prediction or by a reset) and this edge confirms it.
+    beatConfirmed = true;
+    #ifdef REPORT_PREDICTION
+      nrOfConfirmedBeats++;
+      if (sinceBeatStart > maxClockLagTime) {
+        maxClockLagTime = sinceBeatStart;
+      }
+    #endif
+    work |= WORK_RETIME;
+  } else {
+    // The edge arrived before the predicted time (i.e. nearer to the end of the running beat than to
+    // its start), or no beat was running. Start the prepared beat now.
+    #ifdef REPORT_PREDICTION
+      if (beatRunning) {
+        nrOfEarlyClockEdges++;
+        unsigned long leadTime = beatEndTime - thisTime;
+        if (leadTime > maxClockLeadTime) {
+          maxClockLeadTime = leadTime;
         }
-        digitalWrite(CLOCK_OUT, OUT_LOW);
       }
+    #endif
+    beatConfirmed = true;
+    startNextBeat(thisTime, nextEdgeBeatTop, nextEdgeBeatClockSelect, nextEdgeBeatDuration);
+  }
+  if (work) {
+    pendBottomHalf(work);
+  }
+  #ifdef REPORT_ISR_TIMING
+    isrStats.stop(ISR_CLOCK, isrStart);
+  #endif
+}
+
+// The reset edge starts the prepared beat, just like an early clock edge would.
+void resetPredictive() {
+  irqCnt = 0;
+  #ifdef RESTART_CLOCK_SPEED_ESTIMATION_ON_RESET
+    sumTime = 0;
+    irqCounter = 0;
+  #endif
+  if ((settings.device_mode == DIV) && (frac > 0)) {
+    // The reset beat always produces the divided gate.
+    nextBeatLevel = OUT_HIGH;
+  }
+  thisTime = getMicros();
+  anchorTime = thisTime;
+  flywheelBeatsLeft = FLYWHEEL_BEATS;
+  // A clock edge within the reset guard will confirm this beat, a later one starts a new beat.
+  beatConfirmed = false;
+  beatConfirmTime = cycleTime / RESET_GUARD_FRACTION;
+  startNextBeat(thisTime, nextEdgeBeatTop, nextEdgeBeatClockSelect, nextEdgeBeatDuration);
+}
+
+// The beat after the running beat, as the bottom half computes it before publishing it.
+struct BeatPlan {
+  byte number;      // beatNumber of the running beat; the plan is for the beat after it.
+  byte pulses;
+  bool toggles;
+  bool level;
+  uint16_t top;     // Timer1 settings when Timer1 starts the beat at the predicted time.
+  byte clockSelect;
+  unsigned long duration;
+  uint16_t edgeTop; // Timer1 settings when a clock or reset edge starts the beat.
+  byte edgeClockSelect;
+  unsigned long edgeDuration;
+};
+
+// Start a plan for the beat after the running beat, with the pulses as prepared now.
+void beginBeatPlan(BeatPlan *plan) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    plan->number = beatNumber;
+    plan->pulses = nextBeatPulses;
+    plan->toggles = nextBeatToggles;
+    plan->level = nextBeatLevel;
+  }
+}
+
+// Compute the Timer1 settings of the plan. Started by Timer1, the beat ends at the first predicted
+// clock edge at least half a cycle after it starts. Started by a clock edge, which is then the
+// edge predicted for the start of the beat, it lasts the interval predicted after that edge.
+// Predicted clock edges follow the (swung) intervals from the last clock edge on.
+void timeBeatPlan(BeatPlan *plan) {
+  unsigned long startTime, someAnchorTime, someCycleTime;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    startTime = beatEndTime;
+    someAnchorTime = anchorTime;
+    someCycleTime = cycleTime;
+  }
+  unsigned long interval = getBeatTime(0);
+  unsigned long endTime = someAnchorTime + interval;
+  for (byte beatCnt = 1; (beatCnt < FLYWHEEL_BEATS + 2) && ((long)(endTime - startTime) < (long)(someCycleTime / 2)); beatCnt++) {
+    interval = getBeatTime(beatCnt);
+    endTime += interval;
+  }
+  unsigned long duration = endTime - startTime;
+  if ((long) duration < (long)(someCycleTime / 2)) { // The anchor is too old to be of use.
+    duration = someCycleTime;
+    interval = someCycleTime;
+  }
+  unsigned long halfPeriod = computeTimerSetting(duration / 2 / plan->pulses, &plan->top, &plan->clockSelect);
+  plan->duration = 2 * plan->pulses * halfPeriod;
+  halfPeriod = computeTimerSetting(interval / 2 / plan->pulses, &plan->edgeTop, &plan->edgeClockSelect);
+  plan->edgeDuration = 2 * plan->pulses * halfPeriod;
+}
+
+// Publish all fields of the plan at once, so startNextBeat() never combines the pulses of one plan
+// with the Timer1 settings of another. If a beat started after the plan was begun, the plan is
+// out of date and dropped: that beat has pended the bottom half to prepare the next beat anew.
+// Returns whether the plan was published.
+bool publishBeatPlan(const BeatPlan *plan) {
+  bool published = false;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (plan->number == beatNumber) {
+      nextBeatPulses = plan->pulses;
+      nextBeatToggles = plan->toggles;
+      nextBeatLevel = plan->level;
+      nextBeatTop = plan->top;
+      nextBeatClockSelect = plan->clockSelect;
+      nextBeatDuration = plan->duration;
+      nextEdgeBeatTop = plan->edgeTop;
+      nextEdgeBeatClockSelect = plan->edgeClockSelect;
+      nextEdgeBeatDuration = plan->edgeDuration;
+      published = true;
+    }
+  }
+  return(published);
+}
+
+// The clock edge re-anchored the prediction, so the prepared beat has to end at another time.
+void retimeNextBeat() {
+  BeatPlan plan;
+  beginBeatPlan(&plan);
+  timeBeatPlan(&plan);
+  publishBeatPlan(&plan);
+}
+
+// The bottom half for each mode. Decides what the beat after the running beat will look like.
+// Note that the pots and CV inputs are therefore read one beat ahead.
+template <byte MODE> void predictBottomHalf() {
+  #ifdef DEBUG
+    digitalWrite(LED_BUILTIN, led_builtin_state);
+    led_builtin_state = !led_builtin_state;
+  #endif
+  BeatPlan plan;
+  beginBeatPlan(&plan);
+  frac = getModeFraction<MODE>();
+  plan.pulses = 1;
+  plan.toggles = false;
+  plan.level = OUT_LOW;
+  byte someIrqCnt = irqCnt;
+  if (frac == 1) { // We pass the clock pulse unchanged.
+    plan.toggles = true;
+    plan.level = OUT_HIGH;
+  } else if (frac > 1) {
+    if (MODE == DIV) {
+      // We count beats to divide their frequency and leave it up to chance whether we divide or not.
+      someIrqCnt++;
+      if (oddsInFavour() && (someIrqCnt >= frac)) {
+        someIrqCnt = 0;
+        plan.level = OUT_HIGH;
+      }
+    } else {
+      plan.toggles = true;
+      plan.level = OUT_HIGH;
+      if ((MODE == MAX_MULT) || oddsInFavour()) {
+        plan.pulses = frac;
+      }
+    }
+  }
+  timeBeatPlan(&plan);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // The beat is only counted when the plan is used.
+    if (publishBeatPlan(&plan)) {
+      irqCnt = someIrqCnt;
     }
   }
 }
 
-void resetISR() {
-  if (settings.device_mode == DIV) {
-    // There must be at least one cycleTime between responses to external reset signals or a button push.
-    #ifdef RESTART_CLOCK_SPEED_ESTIMATION_ON_RESET
-      sumTime = 0;
-      irqCounter = 0;
+const ClockHandler predictBottomHalves[NR_OF_LED_MODES] = {
+  predictBottomHalf<INIT>, predictBottomHalf<DIV>, predictBottomHalf<ONE>, predictBottomHalf<MULT>, predictBottomHalf<MAX_MULT>,
+  predictBottomHalf<RATIO>
+};
+
+#ifdef REPORT_PREDICTION
+void reportPrediction() {
+  unsigned int confirmed, earlyClock, flywheel;
+  unsigned long maxLag, maxLead;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    confirmed = nrOfConfirmedBeats;
+    earlyClock = nrOfEarlyClockEdges;
+    flywheel = nrOfFlywheelBeats;
+    maxLag = maxClockLagTime;
+    maxLead = maxClockLeadTime;
+    nrOfConfirmedBeats = nrOfEarlyClockEdges = nrOfFlywheelBeats = 0;
+    maxClockLagTime = maxClockLeadTime = 0;
+  }
+  debug_print3("prediction: confirmed beats %u (clock up to %lu uS after the beat) ", confirmed, maxLag);
+  debug_print4("early clock edges %u (up to %lu uS before the predicted beat) flywheel beats %u\n", earlyClock, maxLead, flywheel);
+}
+#endif
+#endif
+
+#ifdef MULTI_CHANNEL
+//
+// Multiple channels. Channel 0 is CLOCK_OUT and follows the front panel, the other channels keep the
+// settings from extraChannels[]. The clock top half only latches the time and stops the bursts of all
+// channels; the bottom half lets the engine decide and start the next beat of every channel.
+//
+
+struct ExtraChannelSetup {
+  byte pin;
+  byte mode;
+  byte factor;
+  byte chance;
+};
+
+#define NR_OF_EXTRA_CHANNELS 2
+const ExtraChannelSetup extraChannels[NR_OF_EXTRA_CHANNELS] = {
+  { 10, CHANNEL_MULT, 2, 50 }, // D10: two ratchets on half of the beats.
+  { 11, CHANNEL_DIV, 2, 100 }  // D11: every other beat.
+};
+
+AvrRatchetHal ratchetHal;
+RatchetEngine<AvrRatchetHal> *ratchetEngine;
+volatile unsigned long channelEdgeTime;
+
+// The top half of the clock edge handling for all channels. Will respond to a rising edge on INT0.
+void clockISRMultiChannel() {
+  #ifdef REPORT_ISR_TIMING
+    unsigned long isrStart = isrStats.start();
+  #endif
+  channelEdgeTime = getMicros();
+  ratchetEngine->stopBursts();
+  // This edge supersedes a reset edge which has not been handled yet.
+  pendingWork &= ~WORK_RESET;
+  pendBottomHalf(WORK_CLOCK);
+  #ifdef REPORT_ISR_TIMING
+    isrStats.stop(ISR_CLOCK, isrStart);
+  #endif
+}
+
+void multiChannelBottomHalf() {
+  #ifdef DEBUG
+    digitalWrite(LED_BUILTIN, led_builtin_state);
+    led_builtin_state = !led_builtin_state;
+  #endif
+  unsigned long edgeTime;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    edgeTime = channelEdgeTime;
+  }
+  ratchetEngine->clockEdge(edgeTime);
+  if (settings.device_mode != MAX_MULT) {
+    ledCompositor.setState(ledChance, ratchetEngine->getChannel(0)->oddsInFavour ? LED_ON : LED_OFF);
+  }
+}
+
+void resetMultiChannel() {
+  channelEdgeTime = getMicros();
+  ratchetEngine->stopBursts();
+  // This edge supersedes a clock edge which has not been handled yet.
+  pendingWork &= ~WORK_CLOCK;
+  pendBottomHalf(WORK_RESET);
+}
+
+// Channel 0 follows the front panel. Called from the main loop.
+void updateMainChannel() {
+  RatchetChannel *channel = ratchetEngine->getChannel(0);
+  byte minValue = frac, maxValue = frac;
+  if (settings.device_mode == MAX_MULT) {
+    // Use the pot for the lower limit and the CV-value for the upper limit.
+    getFraction(NR_OF_MULT_POT_VALUES, potValues4Mult, &minValue, &maxValue);
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    channel->mode = settings.device_mode;
+    channel->factor = minValue;
+    channel->maxFactor = maxValue;
+  }
+  channel->chance = getChanceValue(100);
+}
+
+ISR(TIMER1_COMPA_vect) {
+  #ifdef REPORT_ISR_TIMING
+    unsigned long isrStart = isrStats.start();
+  #endif
+  ratchetEngine->onAlarm(getMicros());
+  #ifdef REPORT_ISR_TIMING
+    isrStats.stop(ISR_RATCHET, isrStart);
+  #endif
+}
+#endif
+
+void resetISR() { // Will respond to a rising edge on INT1
+  #ifdef REPORT_ISR_TIMING
+    unsigned long isrStart = isrStats.start();
+  #endif
+  if (ratioTimerActive) {
+    // The reset edge synchronises the output, like every q-th clock pulse does.
+    synchroniseRatio();
+    #ifdef REPORT_ISR_TIMING
+      isrStats.stop(ISR_RESET, isrStart);
     #endif
-    irqCnt = 0;
-    Timer1.stop();
+    return;
+  }
+  #ifdef MULTI_CHANNEL
+    resetMultiChannel();
+    #ifdef REPORT_ISR_TIMING
+      isrStats.stop(ISR_RESET, isrStart);
+    #endif
+    return;
+  #endif
+  #ifdef PREDICTIVE_OUTPUT
+    #ifdef HIGH_RATE_MODE
+      if (!highRate)
+    #endif
+    {
+      resetPredictive();
+      #ifdef REPORT_ISR_TIMING
+        isrStats.stop(ISR_RESET, isrStart);
+      #endif
+      return;
+    }
+  #endif
+  #ifdef HIGH_RATE_MODE
+    if (highRate) {
+      // Stop a running burst, Timer1 is in CTC mode here.
+      TCCR1B = _BV(WGM12);
+      irqCnt = 0;
+      writeClockOut(OUT_LOW);
+      #ifdef REPORT_ISR_TIMING
+        isrStats.stop(ISR_RESET, isrStart);
+      #endif
+      return;
+    }
+  #endif
+  // Cancel a running burst. This only clears the clock select bits of the timer, so no
+  // burst edge can occur after this point. It is the first thing we do in all modes.
+  stopBurst();
+  irqCnt = 0;
+  // This edge supersedes a clock edge which has not been handled yet.
+  pendingWork &= ~WORK_CLOCK;
+  #ifdef RESTART_CLOCK_SPEED_ESTIMATION_ON_RESET
+    sumTime = 0;
+    irqCounter = 0;
+  #endif
+  #ifdef RESET_ALIGNS_OUTPUT
+    // The reset edge is the first beat. We use the last known value of frac (updated by the
+    // main loop every POTMETER_SCAN_INTERVAL_TIME mS) so that no ADC reads are needed before
+    // the output is set. The reset-to-output latency is thereby limited to the interrupt
+    // response time plus a few instructions (see manual.txt).
+    if (frac == 0) {
+      writeClockOut(OUT_LOW);
+      outState = OUT_LOW;
+    } else {
+      writeClockOut(OUT_HIGH);
+      // The next state will be LOW.
+      outState = OUT_HIGH;
+    }
+    resetTime = getMicros();
+    resetBeatPending = true;
+    // The burst is started by the bottom half.
+    pendBottomHalf(WORK_RESET);
+  #else
     outState = OUT_LOW;
-    digitalWrite(CLOCK_OUT, OUT_LOW);
+    writeClockOut(OUT_LOW);
     // As soon as the next clockISR() occurs, the new output value is set synchronously to the clock
+  #endif
+  #ifdef REPORT_ISR_TIMING
+    isrStats.stop(ISR_RESET, isrStart);
+  #endif
+}
+
+#ifdef RESET_ALIGNS_OUTPUT
+void resetBottomHalf() {
+  // The reset normally comes just before a clock pulse, which belongs to the same beat.
+  // So the beat lasts as long as the interval after that clock pulse.
+  unsigned long beatTime = getBeatTime(1);
+  if (frac == 1) { // We pass one gate with a length of half a cycle.
+    startBurst(beatTime / 2, 1);
+  } else if ((frac > 1) && (settings.device_mode != DIV)) { // Start a new burst.
+    // The chance was drawn by the main loop, so no ADC reads delay the start of the burst.
+    ledCompositor.setState(ledChance, resetOdds ? LED_ON : LED_OFF);
+    if ((settings.device_mode == MAX_MULT) || resetOdds) {
+      startBurst(beatTime / 2 / frac, frac);
+    } else {
+      startBurst(beatTime / 2, 1);
+    }
+  }
+  // In DIV mode with frac > 1 the gate stays high until the next clock pulse which is not divided out.
+}
+#endif
+
+// Clear the work from the pending work and return whether it was still pending.
+// A clock edge may supersede a pending reset and vice versa.
+inline bool takeWork(byte someWork) {
+  bool stillPending;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    stillPending = pendingWork & someWork;
+    pendingWork &= ~someWork;
+  }
+  return(stillPending);
+}
+
+ISR(TIMER2_COMPB_vect, ISR_NOBLOCK) { // The bottom half, runs with interrupts enabled.
+  TIMSK2 &= ~_BV(OCIE2B);
+  if (bottomHalfRunning) {
+    // A top half pended new work while we were busy. The running bottom half will pick it up.
+    return;
+  }
+  bottomHalfRunning = true;
+  #ifdef REPORT_ISR_TIMING
+    unsigned long isrStart = isrStats.start();
+  #endif
+  while (true) {
+    byte work;
+    unsigned long someSumTime;
+    byte someIrqCounter;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      work = pendingWork;
+      // Only the tempo work is cleared here. The clock and reset work is cleared just
+      // before it is handled, so that startBurst() can see whether it became out of date.
+      pendingWork &= ~(WORK_TEMPO | WORK_INTERVAL);
+      someSumTime = pendingSumTime;
+      someIrqCounter = pendingIrqCounter;
+      if (work == 0) {
+        bottomHalfRunning = false;
+      }
+    }
+    if (work == 0) {
+      break;
+    }
+    if (work & WORK_TEMPO) {
+      unsigned long someCycleTime = someSumTime / someIrqCounter;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        cycleTime = someCycleTime;
+      }
+    }
+    #ifdef SWING_TRACKING
+      if (work & WORK_INTERVAL) {
+        drainIntervals();
+      }
+    #endif
+    #ifdef HIGH_RATE_MODE
+      unsigned long someCycleTime;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        someCycleTime = cycleTime;
+      }
+      if ((someCycleTime < HIGH_RATE_ENTER_CYCLE_TIME) && (settings.device_mode != RATIO)) {
+        // The clock edges come faster than the knobs can be read for each of them, so this loop would
+        // never end and the main loop would never get to switch to the high rate mode. Drop the work.
+        takeWork(WORK_CLOCK | WORK_PREPARE);
+        continue;
+      }
+    #endif
+    #ifdef MULTI_CHANNEL
+      if ((work & WORK_RESET) && takeWork(WORK_RESET)) {
+        ratchetEngine->reset(channelEdgeTime);
+      }
+    #endif
+    #ifdef RESET_ALIGNS_OUTPUT
+      if ((work & WORK_RESET) && takeWork(WORK_RESET)) {
+        resetBottomHalf();
+      }
+    #endif
+    if ((work & WORK_CLOCK) && takeWork(WORK_CLOCK)) {
+      activeClockBottomHalf();
+      work |= WORK_PREPARE;
+    }
+    #ifdef PREPARE_CLOCK_EDGE
+      // After the burst has been started, so the ADC reads and draws do not delay it.
+      if (work & (WORK_PREPARE | WORK_RESET)) {
+        takeWork(WORK_PREPARE);
+        activeClockEdgePreparer();
+      }
+    #endif
+    #ifdef PREDICTIVE_OUTPUT
+      if ((work & WORK_RETIME) && takeWork(WORK_RETIME)) {
+        retimeNextBeat();
+      }
+    #endif
+  }
+  #ifdef REPORT_ISR_TIMING
+    isrStats.stop(ISR_DEFERRED, isrStart);
+  #endif
+}
+
+void selectClockHandler();
+
+#ifdef HIGH_RATE_MODE
+//
+// High rate mode
+//
+
+volatile byte highRateFrac;
+// Timer1 compare values (prescaler 1) for a half period of 1 ... NR_OF_MULT_POT_VALUES - 1 pulses per cycle.
+volatile uint16_t pulseTop[NR_OF_MULT_POT_VALUES];
+volatile byte toggleCountDown;
+// Decisions drawn in the main loop, consumed one per clock edge. For DIV a decision is 1 when the odds
+// are in favour of producing a gate. For MULT and MAX_MULT it is the number of pulses to produce.
+volatile byte preparedDecisions[NR_OF_PREPARED_DECISIONS];
+volatile byte decisionHead = 0; // Written by the ISR only.
+volatile byte decisionTail = 0; // Written by the main loop only.
+volatile byte lastDecision = 1;
+
+// The settings the prepared decisions were drawn with.
+byte preparedMode = INIT;
+byte preparedFrac;
+int preparedChanceLevel;
+byte preparedMinValue;
+byte preparedMaxValue;
+
+// Throw away all prepared decisions. Called from the main loop.
+void flushPreparedDecisions() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    decisionTail = decisionHead;
+  }
+}
+
+inline byte nextDecision() {
+  byte head = decisionHead;
+  if (head != decisionTail) {
+    lastDecision = preparedDecisions[head];
+    decisionHead = (head + 1) & (NR_OF_PREPARED_DECISIONS - 1);
+  }
+  // If the main loop could not keep up, we repeat the last decision.
+  return(lastDecision);
+}
+
+inline void startPulses(byte nrOfPulses) {
+  writeClockOut(OUT_HIGH);
+  TCNT1 = 0;
+  OCR1A = pulseTop[nrOfPulses];
+  toggleCountDown = 2 * nrOfPulses - 1;
+  TIFR1 = _BV(OCF1A);                 // Clear a pending compare match of the previous burst.
+  TCCR1B = _BV(WGM12) | _BV(CS10);    // CTC mode, prescaler 1.
+}
+
+// Called from the Timer1 compare interrupt.
+inline void highRateTimerInterrupt() {
+  PIND = _BV(PD5); // Writing a 1 to the PIN register toggles CLOCK_OUT.
+  if (--toggleCountDown == 0) {
+    TCCR1B = _BV(WGM12); // Stop the timer, leave the output low.
+  }
+}
+
+// The clock edge handler for each mode when the input clock is fast.
+// Will respond to a rising edge on INT0.
+template <byte MODE> void clockISRHighRate() {
+  #ifdef REPORT_ISR_TIMING
+    unsigned long isrStart = isrStats.start();
+  #endif
+  thisTime = getMicros();
+  unsigned long interval = thisTime - oldTime;
+  oldTime = thisTime;
+  if (interval > HIGH_RATE_LEAVE_CYCLE_TIME) {
+    // The clock has slowed down or has stopped for a while. Do not wait for the
+    // average so that the main loop can switch back to the normal mode at once.
+    cycleTime = interval;
+    irqCounter = 0;
+    sumTime = 0;
+  } else {
+    sumTime += interval;
+    // Averaging over a power of 2 cycles costs a shift instead of a division.
+    if (++irqCounter >= (1 << HIGH_RATE_CYCLES_SHIFT)) {
+      cycleTime = sumTime >> HIGH_RATE_CYCLES_SHIFT;
+      irqCounter = 0;
+      sumTime = 0;
+    }
+  }
+  byte decision = nextDecision();
+  if (MODE == DIV) {
+    if (highRateFrac == 0) {
+      writeClockOut(OUT_LOW);
+    } else if (highRateFrac == 1) { // We pass the clock pulse unchanged.
+      startPulses(1);
+    } else {
+      irqCnt++;
+      if (decision && (irqCnt >= highRateFrac)) {
+        irqCnt = 0;
+        writeClockOut(OUT_HIGH);
+      } else {
+        writeClockOut(OUT_LOW);
+      }
+    }
+  } else { // The number of pulses for MULT and MAX_MULT was decided in advance.
+    if (decision == 0) {
+      writeClockOut(OUT_LOW);
+    } else {
+      startPulses(decision);
+    }
+  }
+  #ifdef REPORT_ISR_TIMING
+    isrStats.stop(ISR_CLOCK, isrStart);
+  #endif
+}
+
+const ClockHandler highRateClockHandlers[NR_OF_LED_MODES] = {
+  clockISRHighRate<INIT>, clockISRHighRate<DIV>, clockISRHighRate<ONE>, clockISRHighRate<MULT>, clockISRHighRate<MAX_MULT>,
+  clockISRHighRate<RATIO>
+};
+
+#endif
+
+#if defined(HIGH_RATE_MODE) || defined(PREDICTIVE_OUTPUT)
+ISR(TIMER1_COMPA_vect) {
+  #ifdef REPORT_ISR_TIMING
+    unsigned long isrStart = isrStats.start();
+  #endif
+  #if defined(HIGH_RATE_MODE) && defined(PREDICTIVE_OUTPUT)
+    if (highRate) {
+      highRateTimerInterrupt();
+    } else {
+      predictiveTimerInterrupt();
+    }
+  #elif defined(HIGH_RATE_MODE)
+    highRateTimerInterrupt();
+  #else
+    predictiveTimerInterrupt();
+  #endif
+  #ifdef REPORT_ISR_TIMING
+    isrStats.stop(ISR_PULSE, isrStart);
+  #endif
+}
+#endif
+
+// Set up Timer1 for producing the output pulses in the normal (not high rate) mode.
+void initRatchetTimer() {
+  #ifdef PREDICTIVE_OUTPUT
+    TCCR1A = 0;
+    TCCR1B = _BV(WGM12); // CTC mode, stopped.
+    TIMSK1 = _BV(OCIE1A);
+  #elif defined(HARDWARE_BURSTS)
+    // Timer1 is idle, the bursts are produced by Timer0.
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TIMSK1 = 0;
+  #elif defined(MULTI_CHANNEL)
+    // Timer1 runs freely, the engine uses its compare A interrupt.
+    ratchetHal.begin();
+  #else
+    Timer1.initialize(cycleTime / 2);
+    Timer1.attachInterrupt(timerInterrupt);
+    Timer1.stop();
+  #endif
+}
+
+#ifdef HIGH_RATE_MODE
+void enterHighRateMode() {
+  noInterrupts();
+  stopBurst();
+  Timer1.stop();
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12); // CTC mode, stopped.
+  TIMSK1 = _BV(OCIE1A); // Disables the TimerOne overflow interrupt.
+  // Work left for the bottom half belongs to the normal mode.
+  pendingWork = 0;
+  #ifdef PREDICTIVE_OUTPUT
+    beatRunning = false;
+    flywheelBeatsLeft = 0;
+  #endif
+  sumTime = 0;
+  irqCounter = 0;
+  irqCnt = 0;
+  // Decisions left from an earlier visit to high rate mode are stale.
+  decisionTail = decisionHead;
+  preparedMode = INIT;
+  highRate = true;
+  selectClockHandler();
+  interrupts();
+  debug_print2("Entering high rate mode, cycle time: %lu uS\n", cycleTime);
+}
+
+void leaveHighRateMode() {
+  noInterrupts();
+  if (!ratioTimerActive) { // Otherwise Timer1 already produces the ratio tick.
+    TIMSK1 = 0;
+    initRatchetTimer();
+  }
+  sumTime = 0;
+  irqCounter = 0;
+  irqCnt = 0;
+  highRate = false;
+  selectClockHandler();
+  interrupts();
+  debug_print2("Leaving high rate mode, cycle time: %lu uS\n", cycleTime);
+}
+
+// Called from the main loop. Switches between normal and high rate mode and
+// prepares everything the high rate interrupt routines need.
+void tickHighRateMode() {
+  if (settings.device_mode == RATIO) {
+    if (highRate) {
+      leaveHighRateMode();
+    }
+    return;
+  }
+  unsigned long someCycleTime;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    someCycleTime = cycleTime;
+  }
+  if (!highRate) {
+    if (someCycleTime < HIGH_RATE_ENTER_CYCLE_TIME) {
+      enterHighRateMode();
+    } else {
+      return;
+    }
+  } else if (someCycleTime > HIGH_RATE_LEAVE_CYCLE_TIME) {
+    leaveHighRateMode();
+    return;
+  }
+  highRateFrac = frac;
+  for (byte nrOfPulses = 1; nrOfPulses < NR_OF_MULT_POT_VALUES; nrOfPulses++) {
+    unsigned long top = someCycleTime * clockCyclesPerMicrosecond() / 2 / nrOfPulses - 1;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      pulseTop[nrOfPulses] = min(top, 0xFFFFUL);
+    }
+  }
+  byte tail = decisionTail;
+  byte nextTail = (tail + 1) & (NR_OF_PREPARED_DECISIONS - 1);
+  if (nextTail == decisionHead) { // Nothing to do, all decisions are prepared.
+    return;
+  }
+  // The analog values are read once for a whole batch of decisions.
+  int chanceLevel = getChanceValue(100);
+  byte minValue = 0, maxValue = 0;
+  if (settings.device_mode == MAX_MULT) {
+    getFraction(NR_OF_MULT_POT_VALUES, potValues4Mult, &minValue, &maxValue);
+  }
+  // Decisions prepared with other settings would otherwise be played for up to
+  // NR_OF_PREPARED_DECISIONS more clock edges, so they are thrown away.
+  // In MAX_MULT frac is a random draw itself, the decisions only depend on the limits.
+  byte decisionFrac = (settings.device_mode == MAX_MULT) ? 0 : frac;
+  if ((settings.device_mode != preparedMode) || (decisionFrac != preparedFrac) || (chanceLevel != preparedChanceLevel) ||
+      (minValue != preparedMinValue) || (maxValue != preparedMaxValue)) {
+    flushPreparedDecisions();
+    preparedMode = settings.device_mode;
+    preparedFrac = decisionFrac;
+    preparedChanceLevel = chanceLevel;
+    preparedMinValue = minValue;
+    preparedMaxValue = maxValue;
+    tail = decisionTail;
+    nextTail = (tail + 1) & (NR_OF_PREPARED_DECISIONS - 1);
+  }
+  bool chance = false;
+  while (nextTail != decisionHead) {
+    byte decision;
+    if (settings.device_mode == MAX_MULT) {
+      decision = randomNumberGenerator->getRandomNumber(minValue, maxValue + 1, FOUR_BITS);
+    } else {
+      chance = randomNumberGenerator->getRandomNumber(MIN_CHANCE_LEVEL, MAX_CHANCE_LEVEL, SEVEN_BITS) < chanceLevel;
+      if (settings.device_mode == DIV) {
+        decision = chance;
+      } else {
+        decision = ((frac > 1) && !chance) ? 1 : frac;
+      }
+    }
+    preparedDecisions[tail] = decision;
+    tail = nextTail;
+    decisionTail = tail;
+    nextTail = (tail + 1) & (NR_OF_PREPARED_DECISIONS - 1);
+  }
+  if (settings.device_mode != MAX_MULT) {
+    ledCompositor.setState(ledChance, chance ? LED_ON : LED_OFF);
   }
 }
+#endif
+
+// Attach the clock edge handler for the current mode (and rate) to INT0 and
+// select the bottom half for the current mode. Must be called whenever one of them changes.
+void selectClockHandler() {
+  ClockHandler handler = clockISR;
+  ClockHandler bottomHalf = clockBottomHalves[settings.device_mode];
+  #ifdef PREDICTIVE_OUTPUT
+    handler = clockISRPredictive;
+    bottomHalf = predictBottomHalves[settings.device_mode];
+  #endif
+  #ifdef MULTI_CHANNEL
+    handler = clockISRMultiChannel;
+    bottomHalf = multiChannelBottomHalf;
+  #endif
+  #ifdef HIGH_RATE_MODE
+    if (highRate) {
+      handler = highRateClockHandlers[settings.device_mode];
+    }
+  #endif
+  bool ratio = (settings.device_mode == RATIO);
+  if (ratio) { // The phase accumulator handles any input rate by itself.
+    handler = clockISRRatio;
+    bottomHalf = clockBottomHalves[RATIO];
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // Timer1 either produces ratchets or the ratio tick.
+    if (ratio != ratioTimerActive) {
+      // Work left for the bottom half belongs to the previous mode.
+      pendingWork &= ~(WORK_CLOCK | WORK_RESET);
+      if (ratio) {
+        stopBurst();
+        initRatioTimer();
+      } else {
+        initRatchetTimer();
+      }
+      ratioTimerActive = ratio;
+    }
+    activeClockBottomHalf = bottomHalf;
+    #ifdef PREPARE_CLOCK_EDGE
+      activeClockEdgePreparer = clockEdgePreparers[settings.device_mode];
+      pendBottomHalf(WORK_PREPARE);
+    #endif
+    attachInterrupt(digitalPinToInterrupt(EXT_CLOCK_IN), handler, RISING);
+  }
+}
+
+//
+// Timer2 (8 bits) generates a 1 kHz tick which is used to render the leds.
+// Its compare B interrupt is used to run the bottom half.
+//
+
+void initSystemTick() {
+  noInterrupts();
+  TCCR2A = _BV(WGM21);  // CTC mode, TOP = OCR2A.
+  TCCR2B = _BV(CS22);   // Prescaler 64 -> 4 uS per count.
+  OCR2A = (F_CPU / 64 / 1000) - 1; // 250 counts -> 1 mS.
+  TCNT2 = 0;
+  TIMSK2 = _BV(OCIE2A);
+  interrupts();
+  #ifdef HARDWARE_BURSTS
+    initBurstTimer();
+  #endif
+}
+
+ISR(TIMER2_COMPA_vect) {
+  #ifdef HARDWARE_BURSTS
+    // Timer0 produces the bursts, so the time is kept here.
+    timer0_millis++;
+    systemMicrosBase += 1000;
+  #endif
+  #ifdef REPORT_ISR_TIMING
+    // Started after the time was kept, getMicros() would otherwise see this tick as 1 mS.
+    unsigned long isrStart = isrStats.start();
+  #endif
+  ledCompositor.tick();
+  #ifdef REPORT_ISR_TIMING
+    isrStats.stop(ISR_LED_TICK, isrStart);
+  #endif
+}
 
 void toggleBetweenDivAndMultModes() {
   // If the mult/div button was pressed,
@@ -332,23 +1954,31 @@ void toggleBetweenDivAndMultModes() {
   } else {
     settings.device_mode = DIV;
   }
+  selectClockHandler();
   eeprom.writeSettings();
   ledCluster.setMode(settings.device_mode);
 }
 
 void toggleBetweenMultModes() {
-  // When in MULT or MAX_MULT mode, toggle between the two and update eeprom.
+  // When in MULT, MAX_MULT or RATIO mode, cycle through them and update eeprom.
   if (settings.device_mode != DIV) {
     if (settings.device_mode == MULT) {
       settings.device_mode = MAX_MULT;
       oldMultMode = MAX_MULT;
       // We do not use the chance pot or CV value in this mode.
       // so the led will be lit all the time.
-      digitalWrite(LED_CHANCE_MPU, LED_ON);
+      ledCompositor.setState(ledChance, LED_ON);
+    } else if (settings.device_mode == MAX_MULT) {
+      settings.device_mode = RATIO;
+      oldMultMode = RATIO;
+      // Neither in this mode.
+      ledCompositor.setState(ledChance, LED_ON);
     } else {
       settings.device_mode = MULT;
       oldMultMode = MULT;
+      ledCompositor.setState(ledChance, LED_OFF);
     }
+    selectClockHandler();
     ledCluster.setMode(settings.device_mode);
     eeprom.writeSettings();
   }
@@ -389,10 +2019,10 @@ void setup() {
     } else {
       oldMultMode = INITIAL_MULT_MODE;
     }
-    if (settings.device_mode == MAX_MULT) {
-      // We do not use the chance pot or CV value in this mode.
+    if ((settings.device_mode == MAX_MULT) || (settings.device_mode == RATIO)) {
+      // We do not use the chance pot or CV value in these modes.
       // so the led will be lit all the time.
-      digitalWrite(LED_CHANCE_MPU, LED_ON);
+      ledCompositor.setState(ledChance, LED_ON);
     }
 
     pinMode(LED_BUILTIN, OUTPUT);
@@ -417,6 +2047,9 @@ void setup() {
 
     pinMode(LED_CHANCE_MPU, OUTPUT);
 
+    // From here on the led compositor takes care of the leds.
+    initSystemTick();
+
     // Clock inputs.
     //
     pinMode(EXT_CLOCK_IN, INPUT);  // D2/INT0
@@ -436,13 +2069,23 @@ void setup() {
     debug_print3("Setting mode to %d %s\n", settings.device_mode, mode_str[settings.device_mode].c_str());
 
     // Initialize CycleTime before starting the ISR routine.
-    oldTime = micros();
+    oldTime = getMicros();
 
     randomNumberGenerator = new LFSR_RandomNumberGenerator(analogRead(A4)); // Get an unused analog input (electrically floating) as a random seed value.
 
+    #ifdef MULTI_CHANNEL
+      ratchetEngine = new RatchetEngine<AvrRatchetHal>(&ratchetHal, randomNumberGenerator);
+      ratchetEngine->addChannel(CLOCK_OUT, MULT, 1);
+      for (byte channelCnt = 0; channelCnt < NR_OF_EXTRA_CHANNELS; channelCnt++) {
+        const ExtraChannelSetup *setup = &extraChannels[channelCnt];
+        ratchetEngine->addChannel(setup->pin, setup->mode, setup->factor, setup->chance);
+      }
+      updateMainChannel();
+    #endif
+
     // Attach IRQs once all the rest has been initialized
     debug_print2("Attaching interrupt 0 to pin D%d for external clock.\n", EXT_CLOCK_IN);
-    attachInterrupt(digitalPinToInterrupt(EXT_CLOCK_IN), clockISR, RISING);
+    selectClockHandler();
     pinMode(CLOCK_OUT, OUTPUT); // Setting output after setting counter modes as advised by the ATmega321P datasheet.
 
     debug_print2("Attaching interrupt 1 to pin D%d for external reset.\n", EXT_RESET_MPU);
@@ -451,20 +2094,35 @@ void setup() {
     outState = OUT_LOW;
     frac = getFraction();
     debug_print2("Frac: %d\n", frac);
-    Timer1.initialize(cycleTime / 2 / frac);
-    if (settings.device_mode != DIV) { // Mode is MULT or MAX_MULT
-      Timer1.start();
+    if (settings.device_mode == RATIO) {
+      // Timer1 already produces the ratio tick. Nothing is produced until the first clock edge arrives.
+      digitalWrite(CLOCK_OUT, OUT_LOW);
     } else {
-      Timer1.stop();
+    #if defined(PREDICTIVE_OUTPUT) || defined(HARDWARE_BURSTS) || defined(MULTI_CHANNEL)
+      // Nothing is produced until the first clock edge arrives.
+      initRatchetTimer();
+      digitalWrite(CLOCK_OUT, OUT_LOW);
+    #else
+      Timer1.initialize(cycleTime / 2 / max(frac, 1)); // frac is 0 when the knob is at 0.
+      if (settings.device_mode != DIV) { // Mode is MULT or MAX_MULT
+        Timer1.start();
+      } else {
+        Timer1.stop();
+      }
+      digitalWrite(CLOCK_OUT, OUT_HIGH);
+      Timer1.attachInterrupt(timerInterrupt);
+    #endif
     }
-    digitalWrite(CLOCK_OUT, OUT_HIGH);
-    Timer1.attachInterrupt(timerInterrupt);
   #endif
 
   aliveDelay = MillisDelay(BUILT_IN_LED_INTERVAL_TIME);
   aliveDelay.start();
   potmeterScanDelay = MillisDelay(POTMETER_SCAN_INTERVAL_TIME);
   potmeterScanDelay.start();
+  #ifdef REPORT_ISR_TIMING
+    isrTimingReportDelay = MillisDelay(ISR_TIMING_REPORT_INTERVAL_TIME);
+    isrTimingReportDelay.start();
+  #endif
   debug_print("End of Setup()\n");
 }
 
@@ -489,19 +2147,57 @@ void loop() {
     if (potmeterScanDelay.justFinished()) {
       frac = getFraction();
       // debug_print2("%d ", frac);
-      if (frac == 1) {
+      bool isOne = (frac == 1);
+      if (settings.device_mode == RATIO) {
+        isOne = (ratioNumerators[frac] == ratioDenominators[frac]);
+      }
+      if (isOne) {
         ledCluster.setMode(ONE);
       }
        else {
         ledCluster.setMode(settings.device_mode);
       }
+      #ifdef MULTI_CHANNEL
+        updateMainChannel();
+      #endif
+      #ifdef RESET_ALIGNS_OUTPUT
+        resetOdds = drawChance();
+      #endif
+      #ifdef PREPARE_CLOCK_EDGE
+        requestClockEdgePreparation();
+      #endif
+      #ifdef SHOW_FRACTION_AS_BRIGHTNESS
+        if (settings.device_mode == DIV) {
+          ledCluster.showFraction(frac, potValues4Div[NR_OF_DIV_POT_VALUES - 1]);
+        } else if (settings.device_mode == RATIO) {
+          // frac is an index into the ratio tables; every ratio is a setting, so none turns the leds off.
+          ledCluster.showFraction(frac + 1, NR_OF_RATIOS);
+        } else if (settings.device_mode == MAX_MULT) {
+          // frac is a random draw here, so show the setting (the maximum) to avoid flicker.
+          byte minValue, maxValue;
+          getFraction(NR_OF_MULT_POT_VALUES, potValues4Mult, &minValue, &maxValue);
+          ledCluster.showFraction(maxValue, potValues4Mult[NR_OF_MULT_POT_VALUES - 1]);
+        } else {
+          ledCluster.showFraction(frac, potValues4Mult[NR_OF_MULT_POT_VALUES - 1]);
+        }
+      #endif
       potmeterScanDelay.start();
     }
     // Respond to button clicks.
     button.tick();
     // Update the eeprom when necessary.
     eeprom.tick();
-    // Update the 3 mode leds when necessary.
-    ledCluster.tick();
+    #ifdef HIGH_RATE_MODE
+      tickHighRateMode();
+    #endif
+    #ifdef REPORT_ISR_TIMING
+      if (isrTimingReportDelay.justFinished()) {
+        isrStats.report();
+        #ifdef REPORT_PREDICTION
+          reportPrediction();
+        #endif
+        isrTimingReportDelay.start();
+      }
+    #endif
   }
 #endif
\ No newline at end of file
@@ -0,0 +1,1026 @@
+#ifndef _FIRMWARE_HOST_HPP
+#define _FIRMWARE_HOST_HPP
+
+/*
+    Runs the firmware itself (src/main.cpp, unchanged) on a Linux host.
+
+    A tool includes this file, then "../src/main.cpp", and is built with the stub headers in
+    tools/firmware_host on the include path:
+        g++ -std=c++11 -O2 -Wall -Ifirmware_host -o some_tool some_tool.cpp
+
+    Options which are commented out in main.cpp (PREDICTIVE_OUTPUT, HARDWARE_BURSTS, MULTI_CHANNEL)
+    can be defined by the tool before it includes main.cpp. The firmware's printf() goes to the
+    serial output of the host (see setSerialOutput()); a tool which prints itself does #undef printf
+    after including main.cpp.
+
+    What is emulated, in CPU cycles of a 16 MHz ATmega328P:
+    - Timer0, Timer1 and Timer2 in the normal, CTC and PWM modes, with their compare and overflow
+      flags, and OC0B on D5 (set, clear or toggle on compare match B and FOC0B),
+    - the interrupt flag of the CPU (cli(), sei(), SREG, ATOMIC_BLOCK) and the interrupt vectors
+      in the priority order of the ATmega328P, including nested interrupts of ISR_NOBLOCK routines,
+    - INT0 and INT1 via attachInterrupt(), the port registers of port B, C and D, writes to PIND
+      and through portInputRegister() toggling the output,
+    - millis() and micros() as the Arduino core produces them from Timer0 (4 uS resolution); once
+      the firmware takes Timer0 (TOIE0 cleared) millis() returns timer0_millis.
+
+    Code runs in zero time, except analogRead() (ANALOG_READ_TIME), delay(), millis() outside
+    interrupt routines (1 uS, so busy loops on millis() end) and every call of loop() (the loop
+    time, see setLoopTime()). Interrupts which become due meanwhile are handled at that time,
+    so the order of interrupts, top halves and bottom halves is that of the module, but the run
+    time of the interrupt routines themselves is not modelled. Timing figures obtained with this
+    host are therefore no substitute for measurements on a module.
+
+    Note that int is 32 bits and unsigned long is 64 bits on the host.
+*/
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <queue>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef std::string String;
+
+#define F_CPU 16000000UL
+#define FIRMWARE_HOST_CYCLES_PER_US (F_CPU / 1000000UL)
+#define ANALOG_READ_TIME 112      // uS, 13 ADC clocks at 125 kHz plus the overhead of analogRead().
+#define DEFAULT_LOOP_TIME 20      // uS for one call of loop().
+#define FIRMWARE_HOST_NEVER UINT64_MAX
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define LED_BUILTIN 13
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define NR_OF_HOST_PINS 20
+
+#define _BV(bit) (1 << (bit))
+#define clockCyclesPerMicrosecond() (F_CPU / 1000000L)
+#define digitalPinToInterrupt(pin) ((pin) == 2 ? 0 : ((pin) == 3 ? 1 : -1))
+#define noInterrupts() cli()
+#define interrupts() sei()
+
+// Port numbers as used by the Arduino core.
+#define PB 2
+#define PC 3
+#define PD 4
+
+enum {
+    // Timer0.
+    COM0A1 = 7, COM0A0 = 6, COM0B1 = 5, COM0B0 = 4, WGM01 = 1, WGM00 = 0,
+    FOC0A = 7, FOC0B = 6, WGM02 = 3, CS02 = 2, CS01 = 1, CS00 = 0,
+    OCIE0B = 2, OCIE0A = 1, TOIE0 = 0, OCF0B = 2, OCF0A = 1, TOV0 = 0,
+    // Timer1.
+    COM1A1 = 7, COM1A0 = 6, COM1B1 = 5, COM1B0 = 4, WGM11 = 1, WGM10 = 0,
+    ICNC1 = 7, ICES1 = 6, WGM13 = 4, WGM12 = 3, CS12 = 2, CS11 = 1, CS10 = 0,
+    ICIE1 = 5, OCIE1B = 2, OCIE1A = 1, TOIE1 = 0, ICF1 = 5, OCF1B = 2, OCF1A = 1, TOV1 = 0,
+    // Timer2.
+    COM2A1 = 7, COM2A0 = 6, COM2B1 = 5, COM2B0 = 4, WGM21 = 1, WGM20 = 0,
+    FOC2A = 7, FOC2B = 6, WGM22 = 3, CS22 = 2, CS21 = 1, CS20 = 0,
+    OCIE2B = 2, OCIE2A = 1, TOIE2 = 0, OCF2B = 2, OCF2A = 1, TOV2 = 0,
+    // Ports and status register.
+    PB0 = 0, PB1 = 1, PB2 = 2, PB3 = 3, PB4 = 4, PB5 = 5, PB6 = 6, PB7 = 7,
+    PC0 = 0, PC1 = 1, PC2 = 2, PC3 = 3, PC4 = 4, PC5 = 5, PC6 = 6,
+    PD0 = 0, PD1 = 1, PD2 = 2, PD3 = 3, PD4 = 4, PD5 = 5, PD6 = 6, PD7 = 7,
+    SREG_I = 7
+};
+
+// The interrupt vectors in order of priority, as on the ATmega328P.
+enum HostVector {
+    HOST_INT0_vect, HOST_INT1_vect,
+    HOST_TIMER2_COMPA_vect, HOST_TIMER2_COMPB_vect, HOST_TIMER2_OVF_vect,
+    HOST_TIMER1_COMPA_vect, HOST_TIMER1_COMPB_vect, HOST_TIMER1_OVF_vect,
+    HOST_TIMER0_COMPA_vect, HOST_TIMER0_COMPB_vect, HOST_TIMER0_OVF_vect,
+    NR_OF_HOST_VECTORS
+};
+
+enum HostRegisterId {
+    REG_TCCR0A, REG_TCCR0B, REG_TCNT0, REG_OCR0A, REG_OCR0B, REG_TIMSK0, REG_TIFR0,
+    REG_TCCR1A, REG_TCCR1B, REG_TCNT1, REG_OCR1A, REG_OCR1B, REG_ICR1, REG_TIMSK1, REG_TIFR1,
+    REG_TCCR2A, REG_TCCR2B, REG_TCNT2, REG_OCR2A, REG_OCR2B, REG_TIMSK2, REG_TIFR2,
+    REG_PINB, REG_PINC, REG_PIND, REG_SREG
+};
+
+// The millisecond counter of the Arduino core.
+extern "C" {
+    volatile unsigned long timer0_millis = 0;
+}
+
+void setup();
+void loop();
+
+/*
+    One of the timers. The counter position is kept at a tick of the prescaled clock and is
+    only brought up to date when a register is accessed or when the next event is due.
+    An event is the counter leaving a value which sets a flag (TOP, MAX, BOTTOM, OCRnA, OCRnB),
+    so for a CTC period of OCRnA + 1 counts the compare flag is set OCRnA + 1 counts after
+    the counter was written 0.
+*/
+class HostTimer {
+
+    public:
+        uint8_t tccrA = 0;
+        uint8_t tccrB = 0;
+        uint16_t ocrA = 0;
+        uint16_t ocrB = 0;
+        uint16_t icr = 0;
+        uint8_t flags = 0;
+        uint8_t mask = 0;
+        bool outputB = false; // OC0B, Timer0 only.
+
+    private:
+        uint8_t number = 0;
+        uint32_t max = 0xFF;
+        uint64_t refCycle = 0;  // The cycle of the last tick.
+        uint32_t position = 0;  // Counter value, for dual slope 0 ... 2 * TOP - 1.
+
+        uint32_t prescaler() const {
+            static const uint16_t timer2Prescalers[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+            static const uint16_t timerPrescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+            return((number == 2) ? timer2Prescalers[tccrB & 7] : timerPrescalers[tccrB & 7]);
+        }
+
+        uint8_t waveform() const {
+            if (number == 1) {
+                return((tccrA & 3) | ((tccrB >> 1) & 0x0C));
+            }
+            return((tccrA & 3) | ((tccrB >> 1) & 0x04));
+        }
+
+        bool isDualSlope() const {
+            uint8_t mode = waveform();
+            if (number == 1) {
+                return(((mode >= 1) && (mode <= 3)) || ((mode >= 8) && (mode <= 11)));
+            }
+            return((mode == 1) || (mode == 5));
+        }
+
+        // CTC and normal mode, where the compare outputs can toggle.
+        bool isNonPwm() const {
+            uint8_t mode = waveform();
+            if (number == 1) {
+                return((mode == 0) || (mode == 4) || (mode == 12));
+            }
+            return((mode == 0) || (mode == 2));
+        }
+
+        bool isCtc() const {
+            uint8_t mode = waveform();
+            return((number == 1) ? ((mode == 4) || (mode == 12)) : (mode == 2));
+        }
+
+        uint32_t top() const {
+            uint8_t mode = waveform();
+            if (number == 1) {
+                static const uint16_t fixedTops[16] = { 0xFFFF, 0xFF, 0x1FF, 0x3FF, 0, 0xFF, 0x1FF, 0x3FF, 0, 0, 0, 0, 0, 0, 0, 0 };
+                if ((mode == 4) || (mode == 9) || (mode == 11) || (mode == 15)) {
+                    return(ocrA);
+                }
+                if ((mode == 8) || (mode == 10) || (mode == 12) || (mode == 14)) {
+                    return(icr);
+                }
+                return(fixedTops[mode]);
+            }
+            return(((mode == 2) || (mode == 5) || (mode == 7)) ? ocrA : 0xFF);
+        }
+
+        uint32_t period() const {
+            uint32_t someTop = top();
+            if (isDualSlope()) {
+                return((someTop > 0) ? 2 * someTop : 1);
+            }
+            return(someTop + 1);
+        }
+
+        // The counter value the next event is about, and the ticks until the counter leaves it.
+        uint32_t nextEventValue(uint32_t *ticks) const {
+            if (isDualSlope()) {
+                uint32_t somePeriod = period();
+                uint32_t candidates[5] = { 0, ocrA, somePeriod - ocrA, ocrB, somePeriod - ocrB };
+                uint32_t best = somePeriod + 1;
+                uint32_t value = 0;
+                for (uint32_t candidate : candidates) {
+                    if (candidate < somePeriod) {
+                        uint32_t someTicks = ((candidate + somePeriod - position) % somePeriod) + 1;
+                        if (someTicks < best) {
+                            best = someTicks;
+                            value = candidate;
+                        }
+                    }
+                }
+                *ticks = best;
+                return(value);
+            }
+            // Single slope: count up to TOP and wrap, or, when beyond TOP, up to MAX and wrap.
+            uint32_t limit = (position <= top()) ? top() : max;
+            uint32_t candidates[3] = { ocrA, ocrB, limit };
+            uint32_t value = limit;
+            for (uint32_t candidate : candidates) {
+                if ((candidate >= position) && (candidate < value)) {
+                    value = candidate;
+                }
+            }
+            *ticks = value - position + 1;
+            return(value);
+        }
+
+        void actOnOutputB() {
+            switch ((tccrA >> COM0B0) & 3) {
+                case 1: outputB = !outputB; break;
+                case 2: outputB = false; break;
+                case 3: outputB = true; break;
+            }
+        }
+
+    public:
+
+        void begin(uint8_t someNumber) {
+            number = someNumber;
+            max = (number == 1) ? 0xFFFF : 0xFF;
+        }
+
+        // Bring the counter up to date. No event may be due before now.
+        void settle(uint64_t now) {
+            uint32_t somePrescaler = prescaler();
+            if (somePrescaler == 0) {
+                refCycle = now;
+                return;
+            }
+            uint64_t ticks = (now - refCycle) / somePrescaler;
+            position = (uint32_t)((position + ticks) % (isDualSlope() ? period() : (uint64_t)max + 1));
+            refCycle += ticks * somePrescaler;
+        }
+
+        uint64_t nextEventCycle() const {
+            uint32_t somePrescaler = prescaler();
+            if (somePrescaler == 0) {
+                return(FIRMWARE_HOST_NEVER);
+            }
+            uint32_t ticks;
+            nextEventValue(&ticks);
+            return(refCycle + (uint64_t)ticks * somePrescaler);
+        }
+
+        // Handle the next event, which must be due.
+        void step() {
+            uint32_t ticks;
+            uint32_t value = nextEventValue(&ticks);
+            refCycle += (uint64_t)ticks * prescaler();
+            if (isDualSlope()) {
+                uint32_t somePeriod = period();
+                if (value == 0) {
+                    flags |= _BV(TOV0);
+                }
+                if ((value == ocrA) || (value == somePeriod - ocrA)) {
+                    flags |= _BV(OCF0A);
+                }
+                if ((value == ocrB) || (value == somePeriod - ocrB)) {
+                    flags |= _BV(OCF0B);
+                }
+                position = (value + 1) % somePeriod;
+                return;
+            }
+            bool wraps = (value == max) || ((position <= top()) && (value == top()));
+            if (value == ocrA) {
+                flags |= _BV(OCF0A);
+            }
+            if (value == ocrB) {
+                flags |= _BV(OCF0B);
+                if ((number == 0) && isNonPwm()) {
+                    actOnOutputB();
+                }
+            }
+            if ((value == max) || ((value == top()) && !isCtc())) {
+                flags |= _BV(TOV0);
+            }
+            position = wraps ? 0 : value + 1;
+        }
+
+        uint16_t readCounter(uint64_t now) {
+            settle(now);
+            if (isDualSlope() && (position > top())) {
+                return(period() - position);
+            }
+            return(position);
+        }
+
+        void writeCounter(uint64_t now, uint16_t value) {
+            settle(now);
+            position = value;
+        }
+
+        // Called before any other register of the timer is written.
+        void prepareWrite(uint64_t now) {
+            settle(now);
+        }
+
+        // Called after a register of the timer was written.
+        void finishWrite() {
+            if (isDualSlope()) {
+                position %= period();
+            }
+        }
+
+        void writeControlB(uint64_t now, uint8_t value) {
+            settle(now);
+            if ((number == 0) && (value & _BV(FOC0B)) && isNonPwm()) {
+                actOnOutputB(); // A forced compare sets no flag.
+            }
+            tccrB = value & 0x3F;
+            finishWrite();
+        }
+
+        bool outputBConnected() const {
+            return((tccrA >> COM0B0) & 3);
+        }
+};
+
+typedef void (*HostHandler)(void);
+
+class FirmwareHost {
+
+    public:
+        typedef void (*EdgeCallback)(void *context, uint64_t cycle, uint8_t pinNumber, bool level);
+        typedef int (*AnalogSource)(void *context, uint8_t analogNumber, uint64_t cycle);
+
+        HostTimer timers[3];
+        volatile uint8_t portB = 0;
+        volatile uint8_t portC = 0;
+        volatile uint8_t portD = 0;
+        volatile uint8_t ddrB = 0;
+        volatile uint8_t ddrC = 0;
+        volatile uint8_t ddrD = 0;
+        // Writing a 1 to a PIN register through portInputRegister() toggles the output bit.
+        volatile uint8_t pinToggles[3] = { 0, 0, 0 };
+
+    private:
+        struct InputEvent {
+            uint64_t cycle;
+            uint64_t order;
+            uint8_t pinNumber;
+            bool level;
+            bool operator>(const InputEvent &other) const {
+                return((cycle > other.cycle) || ((cycle == other.cycle) && (order > other.order)));
+            }
+        };
+
+        uint64_t cycle = 0;
+        bool interruptFlag = true; // The Arduino core enables interrupts before setup().
+        HostHandler vectors[NR_OF_HOST_VECTORS] = { nullptr };
+        bool noBlock[NR_OF_HOST_VECTORS] = { false };
+        HostHandler externalHandlers[2] = { nullptr, nullptr };
+        uint8_t externalModes[2] = { 0, 0 };
+        uint8_t externalFlags = 0;
+        uint8_t inputLevels[3] = { 0, 0, 0 };
+        uint8_t reportedLevels[3] = { 0, 0, 0 };
+        int analogValues[8] = { 0 };
+        AnalogSource analogSource = nullptr;
+        void *analogContext = nullptr;
+        EdgeCallback edgeCallback = nullptr;
+        void *edgeContext = nullptr;
+        std::priority_queue<InputEvent, std::vector<InputEvent>, std::greater<InputEvent> > inputEvents;
+        uint64_t nrOfInputEvents = 0;
+        uint64_t loopCycles = DEFAULT_LOOP_TIME * FIRMWARE_HOST_CYCLES_PER_US;
+        int interruptDepth = 0;
+        bool setupDone = false;
+        FILE *serialOutput = nullptr;
+
+        static uint8_t portIndex(uint8_t pinNumber) {
+            return((pinNumber < 8) ? 2 : ((pinNumber < 14) ? 0 : 1));
+        }
+
+        static uint8_t portBit(uint8_t pinNumber) {
+            return((pinNumber < 8) ? pinNumber : ((pinNumber < 14) ? pinNumber - 8 : pinNumber - 14));
+        }
+
+        volatile uint8_t *port(uint8_t index) {
+            return((index == 0) ? &portB : ((index == 1) ? &portC : &portD));
+        }
+
+        volatile uint8_t *ddr(uint8_t index) {
+            return((index == 0) ? &ddrB : ((index == 1) ? &ddrC : &ddrD));
+        }
+
+        // The level of the pins of a port: outputs as driven, OC0B on D5 if connected, inputs as applied.
+        uint8_t pinLevels(uint8_t index) {
+            uint8_t levels = (*port(index) & *ddr(index)) | (inputLevels[index] & ~*ddr(index));
+            if ((index == 2) && timers[0].outputBConnected()) {
+                levels = (levels & ~_BV(PD5)) | (timers[0].outputB ? _BV(PD5) : 0);
+            }
+            return(levels);
+        }
+
+        // Apply the toggles written through portInputRegister() and report the pins which changed.
+        void syncPins() {
+            for (uint8_t index = 0; index < 3; index++) {
+                if (pinToggles[index]) {
+                    *port(index) ^= pinToggles[index];
+                    pinToggles[index] = 0;
+                }
+                uint8_t levels = pinLevels(index);
+                uint8_t changed = levels ^ reportedLevels[index];
+                if (changed == 0) {
+                    continue;
+                }
+                reportedLevels[index] = levels;
+                if (edgeCallback == nullptr) {
+                    continue;
+                }
+                for (uint8_t bitNr = 0; bitNr < 8; bitNr++) {
+                    if (changed & _BV(bitNr)) {
+                        uint8_t pinNumber = (index == 2) ? bitNr : ((index == 0) ? bitNr + 8 : bitNr + 14);
+                        edgeCallback(edgeContext, cycle, pinNumber, levels & _BV(bitNr));
+                    }
+                }
+            }
+        }
+
+        uint8_t pendingFlags(uint8_t vector) {
+            switch (vector) {
+                case HOST_INT0_vect: return(externalFlags & 1);
+                case HOST_INT1_vect: return(externalFlags & 2);
+                case HOST_TIMER2_COMPA_vect: return(timers[2].flags & timers[2].mask & _BV(OCF2A));
+                case HOST_TIMER2_COMPB_vect: return(timers[2].flags & timers[2].mask & _BV(OCF2B));
+                case HOST_TIMER2_OVF_vect: return(timers[2].flags & timers[2].mask & _BV(TOV2));
+                case HOST_TIMER1_COMPA_vect: return(timers[1].flags & timers[1].mask & _BV(OCF1A));
+                case HOST_TIMER1_COMPB_vect: return(timers[1].flags & timers[1].mask & _BV(OCF1B));
+                case HOST_TIMER1_OVF_vect: return(timers[1].flags & timers[1].mask & _BV(TOV1));
+                case HOST_TIMER0_COMPA_vect: return(timers[0].flags & timers[0].mask & _BV(OCF0A));
+                case HOST_TIMER0_COMPB_vect: return(timers[0].flags & timers[0].mask & _BV(OCF0B));
+                case HOST_TIMER0_OVF_vect: return(timers[0].flags & timers[0].mask & _BV(TOV0));
+            }
+            return(0);
+        }
+
+        // The hardware clears the flag of a timer interrupt when its routine starts.
+        void clearFlag(uint8_t vector) {
+            if (vector <= HOST_INT1_vect) {
+                externalFlags &= ~_BV(vector - HOST_INT0_vect);
+            } else {
+                HostTimer *timer = &timers[2 - (vector - HOST_TIMER2_COMPA_vect) / 3];
+                static const uint8_t bits[3] = { _BV(OCF0A), _BV(OCF0B), _BV(TOV0) };
+                timer->flags &= ~bits[(vector - HOST_TIMER2_COMPA_vect) % 3];
+            }
+        }
+
+        // Run the interrupt routines which are due, as long as interrupts are enabled.
+        void service() {
+            syncPins();
+            while (interruptFlag) {
+                uint8_t vector = 0;
+                while ((vector < NR_OF_HOST_VECTORS) && !pendingFlags(vector)) {
+                    vector++;
+                }
+                if (vector == NR_OF_HOST_VECTORS) {
+                    break;
+                }
+                clearFlag(vector);
+                interruptFlag = noBlock[vector];
+                interruptDepth++;
+                if (vector <= HOST_INT1_vect) {
+                    if (externalHandlers[vector] != nullptr) {
+                        externalHandlers[vector]();
+                    }
+                } else if (vectors[vector] != nullptr) {
+                    vectors[vector]();
+                } else if (vector != HOST_TIMER0_OVF_vect) { // That one counts millis() in the Arduino core.
+                    fprintf(stderr, "firmware host: interrupt %d has no interrupt routine, the module would reset\n", vector);
+                    abort();
+                }
+                interruptDepth--;
+                interruptFlag = true;
+                syncPins();
+            }
+        }
+
+        uint64_t nextEventCycle() {
+            uint64_t next = inputEvents.empty() ? FIRMWARE_HOST_NEVER : inputEvents.top().cycle;
+            for (uint8_t timerNr = 0; timerNr < 3; timerNr++) {
+                uint64_t timerCycle = timers[timerNr].nextEventCycle();
+                if (timerCycle < next) {
+                    next = timerCycle;
+                }
+            }
+            return(next);
+        }
+
+        void applyInput(uint8_t pinNumber, bool level) {
+            uint8_t index = portIndex(pinNumber);
+            uint8_t bitMask = _BV(portBit(pinNumber));
+            bool oldLevel = inputLevels[index] & bitMask;
+            inputLevels[index] = level ? (inputLevels[index] | bitMask) : (inputLevels[index] & ~bitMask);
+            int interruptNr = digitalPinToInterrupt(pinNumber);
+            if ((interruptNr < 0) || (externalHandlers[interruptNr] == nullptr) || (oldLevel == level)) {
+                return;
+            }
+            uint8_t mode = externalModes[interruptNr];
+            if ((mode == CHANGE) || ((mode == RISING) && level) || ((mode == FALLING) && !level)) {
+                externalFlags |= _BV(interruptNr);
+            }
+        }
+
+        HostTimer *timerOf(uint8_t id, uint8_t *timerNr) {
+            *timerNr = (id <= REG_TIFR0) ? 0 : ((id <= REG_TIFR1) ? 1 : 2);
+            return(&timers[*timerNr]);
+        }
+
+    public:
+
+        FirmwareHost() {
+            for (uint8_t timerNr = 0; timerNr < 3; timerNr++) {
+                timers[timerNr].begin(timerNr);
+            }
+            // The timers as init() of the Arduino core leaves them.
+            timers[0].tccrA = _BV(WGM01) | _BV(WGM00);
+            timers[0].tccrB = _BV(CS01) | _BV(CS00);
+            timers[0].mask = _BV(TOIE0);
+            timers[1].tccrA = _BV(WGM10);
+            timers[1].tccrB = _BV(CS11) | _BV(CS10);
+            timers[2].tccrA = _BV(WGM20);
+            timers[2].tccrB = _BV(CS22);
+        }
+
+        void attachVector(uint8_t vector, HostHandler handler, bool someNoBlock) {
+            vectors[vector] = handler;
+            noBlock[vector] = someNoBlock;
+        }
+
+        void attachExternal(uint8_t interruptNr, HostHandler handler, uint8_t mode) {
+            if (interruptNr < 2) {
+                externalHandlers[interruptNr] = handler;
+                externalModes[interruptNr] = mode;
+            }
+        }
+
+        void detachExternal(uint8_t interruptNr) {
+            if (interruptNr < 2) {
+                externalHandlers[interruptNr] = nullptr;
+            }
+        }
+
+        // The time in CPU cycles.
+        uint64_t now() const {
+            return(cycle);
+        }
+
+        uint64_t nowMicros() const {
+            return(cycle / FIRMWARE_HOST_CYCLES_PER_US);
+        }
+
+        bool inInterrupt() const {
+            return(interruptDepth > 0);
+        }
+
+        bool getInterruptFlag() const {
+            return(interruptFlag);
+        }
+
+        void setInterruptFlag(bool flag) {
+            interruptFlag = flag;
+            if (flag) {
+                service();
+            }
+        }
+
+        // Let time pass until untilCycle and handle everything that happens meanwhile.
+        void runUntil(uint64_t untilCycle) {
+            syncPins();
+            while (true) {
+                uint64_t next = nextEventCycle();
+                if (next > untilCycle) {
+                    break;
+                }
+                if (next > cycle) {
+                    cycle = next;
+                }
+                for (uint8_t timerNr = 0; timerNr < 3; timerNr++) {
+                    while (timers[timerNr].nextEventCycle() <= cycle) {
+                        timers[timerNr].step();
+                    }
+                }
+                while (!inputEvents.empty() && (inputEvents.top().cycle <= cycle)) {
+                    InputEvent event = inputEvents.top();
+                    inputEvents.pop();
+                    applyInput(event.pinNumber, event.level);
+                }
+                service();
+            }
+            // An interrupt routine may have taken us past untilCycle already.
+            if (untilCycle > cycle) {
+                cycle = untilCycle;
+            }
+        }
+
+        void advance(uint64_t cycles) {
+            runUntil(cycle + cycles);
+        }
+
+        // Run setup(), once.
+        void begin() {
+            if (!setupDone) {
+                setupDone = true;
+                setup();
+                service();
+            }
+        }
+
+        // Run setup() if that was not done yet, then loop() until untilCycle.
+        void run(uint64_t untilCycle) {
+            begin();
+            while (cycle < untilCycle) {
+                loop();
+                advance(loopCycles);
+            }
+        }
+
+        void runMicros(uint64_t untilMicros) {
+            run(untilMicros * FIRMWARE_HOST_CYCLES_PER_US);
+        }
+
+        void setLoopTime(uint32_t micros) {
+            loopCycles = micros * FIRMWARE_HOST_CYCLES_PER_US;
+        }
+
+        // Let a pin of the module change to level at the given cycle, e.g. a clock or reset edge.
+        void scheduleInput(uint64_t atCycle, uint8_t pinNumber, bool level) {
+            inputEvents.push({ atCycle, nrOfInputEvents++, pinNumber, level });
+        }
+
+        void setEdgeCallback(EdgeCallback callback, void *context) {
+            edgeCallback = callback;
+            edgeContext = context;
+        }
+
+        // Set a fixed value (0 ... 1023) for analog input analogNumber (0 ... 7 or A0 ... A5).
+        void setAnalogValue(uint8_t analogNumber, int value) {
+            analogValues[(analogNumber >= A0) ? analogNumber - A0 : analogNumber] = value;
+        }
+
+        // Let the analog values be computed at the moment they are sampled.
+        void setAnalogSource(AnalogSource source, void *context) {
+            analogSource = source;
+            analogContext = context;
+        }
+
+        void setSerialOutput(FILE *file) {
+            serialOutput = file;
+        }
+
+        FILE *getSerialOutput() const {
+            return(serialOutput);
+        }
+
+        int readAnalog(uint8_t pinNumber) {
+            uint8_t analogNumber = ((pinNumber >= A0) ? pinNumber - A0 : pinNumber) & 7;
+            // The input is sampled at the start of the conversion.
+            int value = (analogSource != nullptr) ? analogSource(analogContext, analogNumber, cycle) : analogValues[analogNumber];
+            advance(ANALOG_READ_TIME * FIRMWARE_HOST_CYCLES_PER_US);
+            return(value);
+        }
+
+        volatile uint8_t *portRegister(uint8_t portNumber) {
+            return(port(portNumber == PB ? 0 : (portNumber == PC ? 1 : 2)));
+        }
+
+        volatile uint8_t *modeRegister(uint8_t portNumber) {
+            return(ddr(portNumber == PB ? 0 : (portNumber == PC ? 1 : 2)));
+        }
+
+        volatile uint8_t *toggleRegister(uint8_t portNumber) {
+            return(&pinToggles[portNumber == PB ? 0 : (portNumber == PC ? 1 : 2)]);
+        }
+
+        void setPinMode(uint8_t pinNumber, uint8_t mode) {
+            volatile uint8_t *someDdr = ddr(portIndex(pinNumber));
+            uint8_t bitMask = _BV(portBit(pinNumber));
+            *someDdr = (mode == OUTPUT) ? (*someDdr | bitMask) : (*someDdr & ~bitMask);
+        }
+
+        void writePin(uint8_t pinNumber, uint8_t level) {
+            volatile uint8_t *somePort = port(portIndex(pinNumber));
+            uint8_t bitMask = _BV(portBit(pinNumber));
+            *somePort = level ? (*somePort | bitMask) : (*somePort & ~bitMask);
+        }
+
+        bool readPin(uint8_t pinNumber) {
+            syncPins();
+            return(pinLevels(portIndex(pinNumber)) & _BV(portBit(pinNumber)));
+        }
+
+        unsigned long readMillis() {
+            if (timers[0].mask & _BV(TOIE0)) { // Timer0 still counts the time of the Arduino core.
+                timer0_millis = cycle / (1000 * FIRMWARE_HOST_CYCLES_PER_US);
+            }
+            if (!inInterrupt()) {
+                advance(FIRMWARE_HOST_CYCLES_PER_US);
+            }
+            return(timer0_millis);
+        }
+
+        unsigned long readMicros() {
+            return((cycle / (4 * FIRMWARE_HOST_CYCLES_PER_US)) * 4);
+        }
+
+        uint16_t readRegister(uint8_t id) {
+            if (id == REG_SREG) {
+                return(interruptFlag ? _BV(SREG_I) : 0);
+            }
+            if (id >= REG_PINB) {
+                syncPins();
+                return(pinLevels(id - REG_PINB));
+            }
+            uint8_t timerNr;
+            HostTimer *timer = timerOf(id, &timerNr);
+            switch (id) {
+                case REG_TCCR0A: case REG_TCCR1A: case REG_TCCR2A: return(timer->tccrA);
+                case REG_TCCR0B: case REG_TCCR1B: case REG_TCCR2B: return(timer->tccrB);
+                case REG_TCNT0: case REG_TCNT1: case REG_TCNT2: return(timer->readCounter(cycle));
+                case REG_OCR0A: case REG_OCR1A: case REG_OCR2A: return(timer->ocrA);
+                case REG_OCR0B: case REG_OCR1B: case REG_OCR2B: return(timer->ocrB);
+                case REG_ICR1: return(timer->icr);
+                case REG_TIMSK0: case REG_TIMSK1: case REG_TIMSK2: return(timer->mask);
+                case REG_TIFR0: case REG_TIFR1: case REG_TIFR2: return(timer->flags);
+            }
+            return(0);
+        }
+
+        void writeRegister(uint8_t id, uint16_t value) {
+            if (id == REG_SREG) {
+                setInterruptFlag(value & _BV(SREG_I));
+                return;
+            }
+            if (id >= REG_PINB) { // Writing a 1 to a PIN register toggles the output.
+                *port(id - REG_PINB) ^= value;
+                syncPins();
+                return;
+            }
+            uint8_t timerNr;
+            HostTimer *timer = timerOf(id, &timerNr);
+            switch (id) {
+                case REG_TCNT0: case REG_TCNT1: case REG_TCNT2:
+                    timer->writeCounter(cycle, value);
+                    break;
+                case REG_TCCR0B: case REG_TCCR1B: case REG_TCCR2B:
+                    timer->writeControlB(cycle, value);
+                    break;
+                case REG_TIFR0: case REG_TIFR1: case REG_TIFR2:
+                    timer->flags &= ~value; // Writing a 1 clears the flag.
+                    break;
+                case REG_TIMSK0: case REG_TIMSK1: case REG_TIMSK2:
+                    if ((timerNr == 0) && (timer->mask & _BV(TOIE0)) && !(value & _BV(TOIE0))) {
+                        // The firmware takes Timer0, millis() stops where the Arduino core left it.
+                        timer0_millis = cycle / (1000 * FIRMWARE_HOST_CYCLES_PER_US);
+                    }
+                    timer->mask = value;
+                    service();
+                    break;
+                default:
+                    timer->prepareWrite(cycle);
+                    switch (id) {
+                        case REG_TCCR0A: case REG_TCCR1A: case REG_TCCR2A: timer->tccrA = value; break;
+                        case REG_OCR0A: case REG_OCR1A: case REG_OCR2A: timer->ocrA = value; break;
+                        case REG_OCR0B: case REG_OCR1B: case REG_OCR2B: timer->ocrB = value; break;
+                        case REG_ICR1: timer->icr = value; break;
+                    }
+                    timer->finishWrite();
+                    syncPins(); // Connecting or disconnecting OC0B may change D5.
+            }
+        }
+
+        int serialPrintf(const char *format, va_list arguments) {
+            if (serialOutput == nullptr) {
+                return(0);
+            }
+            return(vfprintf(serialOutput, format, arguments));
+        }
+};
+
+FirmwareHost firmwareHost;
+
+// An I/O register of the module. Every access goes through the firmware host.
+template <uint8_t ID, typename T> class HostRegister {
+
+    public:
+        operator T() const {
+            return((T)firmwareHost.readRegister(ID));
+        }
+
+        HostRegister &operator=(int value) {
+            firmwareHost.writeRegister(ID, (T)value);
+            return(*this);
+        }
+
+        HostRegister &operator=(const HostRegister &other) {
+            firmwareHost.writeRegister(ID, (T)other);
+            return(*this);
+        }
+
+        HostRegister &operator|=(int value) {
+            firmwareHost.writeRegister(ID, (T)(firmwareHost.readRegister(ID) | value));
+            return(*this);
+        }
+
+        HostRegister &operator&=(int value) {
+            firmwareHost.writeRegister(ID, (T)(firmwareHost.readRegister(ID) & value));
+            return(*this);
+        }
+
+        HostRegister &operator^=(int value) {
+            firmwareHost.writeRegister(ID, (T)(firmwareHost.readRegister(ID) ^ value));
+            return(*this);
+        }
+};
+
+HostRegister<REG_TCCR0A, uint8_t> TCCR0A;
+HostRegister<REG_TCCR0B, uint8_t> TCCR0B;
+HostRegister<REG_TCNT0, uint8_t> TCNT0;
+HostRegister<REG_OCR0A, uint8_t> OCR0A;
+HostRegister<REG_OCR0B, uint8_t> OCR0B;
+HostRegister<REG_TIMSK0, uint8_t> TIMSK0;
+HostRegister<REG_TIFR0, uint8_t> TIFR0;
+HostRegister<REG_TCCR1A, uint8_t> TCCR1A;
+HostRegister<REG_TCCR1B, uint8_t> TCCR1B;
+HostRegister<REG_TCNT1, uint16_t> TCNT1;
+HostRegister<REG_OCR1A, uint16_t> OCR1A;
+HostRegister<REG_OCR1B, uint16_t> OCR1B;
+HostRegister<REG_ICR1, uint16_t> ICR1;
+HostRegister<REG_TIMSK1, uint8_t> TIMSK1;
+HostRegister<REG_TIFR1, uint8_t> TIFR1;
+HostRegister<REG_TCCR2A, uint8_t> TCCR2A;
+HostRegister<REG_TCCR2B, uint8_t> TCCR2B;
+HostRegister<REG_TCNT2, uint8_t> TCNT2;
+HostRegister<REG_OCR2A, uint8_t> OCR2A;
+HostRegister<REG_OCR2B, uint8_t> OCR2B;
+HostRegister<REG_TIMSK2, uint8_t> TIMSK2;
+HostRegister<REG_TIFR2, uint8_t> TIFR2;
+HostRegister<REG_PINB, uint8_t> PINB;
+HostRegister<REG_PINC, uint8_t> PINC;
+HostRegister<REG_PIND, uint8_t> PIND;
+HostRegister<REG_SREG, uint8_t> SREG;
+
+#define PORTB (firmwareHost.portB)
+#define PORTC (firmwareHost.portC)
+#define PORTD (firmwareHost.portD)
+#define DDRB (firmwareHost.ddrB)
+#define DDRC (firmwareHost.ddrC)
+#define DDRD (firmwareHost.ddrD)
+
+inline void cli() {
+    firmwareHost.setInterruptFlag(false);
+}
+
+inline void sei() {
+    firmwareHost.setInterruptFlag(true);
+}
+
+// Interrupt routines register themselves with the firmware host.
+class HostIsrRegistration {
+
+    public:
+        HostIsrRegistration(uint8_t vector, HostHandler handler, bool noBlock) {
+            firmwareHost.attachVector(vector, handler, noBlock);
+        }
+};
+
+#define ISR_BLOCK 0
+#define ISR_NOBLOCK 1
+#define ISR(vector, ...) \
+    static void vector##_routine(void); \
+    static HostIsrRegistration vector##_registration(HOST_##vector, vector##_routine, (__VA_ARGS__ + 0) != 0); \
+    static void vector##_routine(void)
+
+// ATOMIC_BLOCK of util/atomic.h.
+#define ATOMIC_RESTORESTATE 1
+#define ATOMIC_FORCEON 2
+
+class HostAtomicBlock {
+
+    private:
+        bool oldFlag;
+        int type;
+        bool done = false;
+
+    public:
+        HostAtomicBlock(int someType): oldFlag(firmwareHost.getInterruptFlag()), type(someType) {
+            firmwareHost.setInterruptFlag(false);
+        }
+
+        ~HostAtomicBlock() {
+            firmwareHost.setInterruptFlag((type == ATOMIC_FORCEON) || oldFlag);
+        }
+
+        bool once() {
+            bool first = !done;
+            done = true;
+            return(first);
+        }
+};
+
+#define ATOMIC_BLOCK(type) for (HostAtomicBlock hostAtomicBlock(type); hostAtomicBlock.once(); )
+
+// The Arduino core.
+template <typename T, typename U> auto min(T one, U other) -> typename std::common_type<T, U>::type {
+    return((one < other) ? one : other);
+}
+
+template <typename T, typename U> auto max(T one, U other) -> typename std::common_type<T, U>::type {
+    return((one > other) ? one : other);
+}
+
+inline long map(long value, long fromLow, long fromHigh, long toLow, long toHigh) {
+    return((value - fromLow) * (toHigh - toLow) / (fromHigh - fromLow) + toLow);
+}
+
+inline void pinMode(uint8_t pinNumber, uint8_t mode) {
+    firmwareHost.setPinMode(pinNumber, mode);
+}
+
+inline void digitalWrite(uint8_t pinNumber, uint8_t level) {
+    firmwareHost.writePin(pinNumber, level);
+}
+
+inline int digitalRead(uint8_t pinNumber) {
+    return(firmwareHost.readPin(pinNumber) ? HIGH : LOW);
+}
+
+inline int analogRead(uint8_t pinNumber) {
+    return(firmwareHost.readAnalog(pinNumber));
+}
+
+inline unsigned long millis() {
+    return(firmwareHost.readMillis());
+}
+
+inline unsigned long micros() {
+    return(firmwareHost.readMicros());
+}
+
+inline void delay(unsigned long milliSeconds) {
+    firmwareHost.advance(milliSeconds * 1000 * FIRMWARE_HOST_CYCLES_PER_US);
+}
+
+inline void delayMicroseconds(unsigned int microSeconds) {
+    firmwareHost.advance(microSeconds * FIRMWARE_HOST_CYCLES_PER_US);
+}
+
+inline void attachInterrupt(uint8_t interruptNr, void (*handler)(void), int mode) {
+    firmwareHost.attachExternal(interruptNr, handler, mode);
+}
+
+inline void detachInterrupt(uint8_t interruptNr) {
+    firmwareHost.detachExternal(interruptNr);
+}
+
+inline uint8_t digitalPinToPort(uint8_t pinNumber) {
+    return((pinNumber < 8) ? PD : ((pinNumber < 14) ? PB : PC));
+}
+
+inline uint8_t digitalPinToBitMask(uint8_t pinNumber) {
+    return(_BV((pinNumber < 8) ? pinNumber : ((pinNumber < 14) ? pinNumber - 8 : pinNumber - 14)));
+}
+
+inline volatile uint8_t *portOutputRegister(uint8_t portNumber) {
+    return(firmwareHost.portRegister(portNumber));
+}
+
+inline volatile uint8_t *portInputRegister(uint8_t portNumber) {
+    return(firmwareHost.toggleRegister(portNumber));
+}
+
+inline volatile uint8_t *portModeRegister(uint8_t portNumber) {
+    return(firmwareHost.modeRegister(portNumber));
+}
+
+inline int hostSerialPrintf(const char *format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    int result = firmwareHost.serialPrintf(format, arguments);
+    va_end(arguments);
+    return(result);
+}
+
+class HostSerial {
+
+    public:
+        void begin(unsigned long) {}
+};
+
+HostSerial Serial;
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef _HOST_RATCHET_HAL_HPP
+#define _HOST_RATCHET_HAL_HPP
+
+/*
+    A simulated hardware layer for the RatchetEngine, so the engine can be run on a Linux host.
+
+    Time only moves when the simulation says so. runUntil() lets the alarm go off at the
+    requested times (plus an optional interrupt latency) and calls the engine, just like the
+    Timer1 compare interrupt does on the module. Every change of an output pin is reported
+    to an edge callback.
+*/
+
+#include <stdint.h>
+#include "RatchetEngine.hpp"
+
+class HostRatchetHal {
+
+    public:
+        typedef void (*EdgeCallback)(void *context, uint32_t time, uint8_t pinNumber, bool level);
+
+    private:
+        uint32_t time = 0;
+        uint32_t alarmTime = 0;
+        bool alarmArmed = false;
+        uint32_t latency = 0;
+        uint8_t portNumbers[MAX_NR_OF_CHANNEL_PORTS];
+        uint8_t portBits[MAX_NR_OF_CHANNEL_PORTS] = { 0 };
+        uint8_t nrOfPorts = 0;
+        EdgeCallback edgeCallback = nullptr;
+        void *edgeContext = nullptr;
+
+        void report(uint8_t portIndex, uint8_t changedBits) {
+            if (edgeCallback == nullptr) {
+                return;
+            }
+            for (uint8_t bitNr = 0; bitNr < 8; bitNr++) {
+                if (changedBits & (1 << bitNr)) {
+                    edgeCallback(edgeContext, time, portNumbers[portIndex] * 8 + bitNr, portBits[portIndex] & (1 << bitNr));
+                }
+            }
+        }
+
+    public:
+
+        HostRatchetHal() {}
+
+        void setEdgeCallback(EdgeCallback callback, void *context) {
+            edgeCallback = callback;
+            edgeContext = context;
+        }
+
+        // The time between the alarm time and the moment the engine is called, in uS.
+        void setLatency(uint32_t someLatency) {
+            latency = someLatency;
+        }
+
+        // Pin n is bit n % 8 of port n / 8.
+        void addPin(uint8_t pinNumber, uint8_t *portIndex, uint8_t *bitMask) {
+            *bitMask = 1 << (pinNumber % 8);
+            for (uint8_t portCnt = 0; portCnt < nrOfPorts; portCnt++) {
+                if (portNumbers[portCnt] == pinNumber / 8) {
+                    *portIndex = portCnt;
+                    return;
+                }
+            }
+            if (nrOfPorts >= MAX_NR_OF_CHANNEL_PORTS) {
+                *portIndex = 0;
+                *bitMask = 0;
+                return;
+            }
+            portNumbers[nrOfPorts] = pinNumber / 8;
+            *portIndex = nrOfPorts++;
+        }
+
+        uint32_t now() {
+            return(time);
+        }
+
+        void setTime(uint32_t someTime) {
+            time = someTime;
+        }
+
+        void setAlarm(uint32_t someTime) {
+            alarmTime = someTime;
+            alarmArmed = true;
+        }
+
+        void cancelAlarm() {
+            alarmArmed = false;
+        }
+
+        void writeBits(uint8_t portIndex, uint8_t mask, uint8_t bits) {
+            uint8_t oldBits = portBits[portIndex];
+            portBits[portIndex] = (oldBits & ~mask) | (bits & mask);
+            report(portIndex, oldBits ^ portBits[portIndex]);
+        }
+
+        void toggleBits(uint8_t portIndex, uint8_t mask) {
+            portBits[portIndex] ^= mask;
+            report(portIndex, mask);
+        }
+
+        uint8_t lock() {
+            return(0);
+        }
+
+        void unlock(uint8_t) {
+        }
+
+        // Let every alarm up to and including untilTime go off, then set the time to untilTime.
+        template <class Engine> void runUntil(Engine *engine, uint32_t untilTime) {
+            while (alarmArmed && ((int32_t)(alarmTime + latency - untilTime) <= 0)) {
+                alarmArmed = false;
+                time = alarmTime + latency;
+                engine->onAlarm(time);
+            }
+            time = untilTime;
+        }
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef _WORK_STEALING_POOL_HPP
+#define _WORK_STEALING_POOL_HPP
+
+/*
+    A small work stealing thread pool for the host tools.
+
+    Every worker has its own deque of jobs. The jobs are dealt out round robin before the
+    workers start. A worker takes jobs from the back of its own deque and, when that is
+    empty, steals from the front of the deque of another worker, so workers which got
+    quick jobs help out the ones which got slow jobs. A job is an index into the caller's
+    own array of work, so nothing but integers is moved around.
+*/
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+
+    private:
+        struct Worker {
+            std::deque<size_t> jobs;
+            std::mutex mutex;
+        };
+
+        std::vector<Worker> workers;
+
+        bool popOwn(size_t workerNr, size_t *job) {
+            Worker &worker = workers[workerNr];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.jobs.empty()) {
+                return(false);
+            }
+            *job = worker.jobs.back();
+            worker.jobs.pop_back();
+            return(true);
+        }
+
+        bool steal(size_t thiefNr, size_t *job) {
+            for (size_t offset = 1; offset < workers.size(); offset++) {
+                Worker &victim = workers[(thiefNr + offset) % workers.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.jobs.empty()) {
+                    *job = victim.jobs.front();
+                    victim.jobs.pop_front();
+                    return(true);
+                }
+            }
+            return(false);
+        }
+
+    public:
+        std::atomic<size_t> nrOfSteals;
+
+        explicit WorkStealingPool(size_t nrOfWorkers):
+            workers(nrOfWorkers > 0 ? nrOfWorkers : 1), nrOfSteals(0) { }
+
+        size_t getNrOfWorkers() {
+            return(workers.size());
+        }
+
+        // Run job(jobNr, workerNr) for every jobNr in 0 ... nrOfJobs - 1 and wait until all are done.
+        void run(size_t nrOfJobs, const std::function<void(size_t, size_t)> &job) {
+            for (size_t jobNr = 0; jobNr < nrOfJobs; jobNr++) {
+                workers[jobNr % workers.size()].jobs.push_back(jobNr);
+            }
+            std::vector<std::thread> threads;
+            for (size_t workerNr = 0; workerNr < workers.size(); workerNr++) {
+                threads.emplace_back([this, workerNr, &job]() {
+                    size_t jobNr;
+                    while (true) {
+                        if (popOwn(workerNr, &jobNr)) {
+                            job(jobNr, workerNr);
+                        } else if (steal(workerNr, &jobNr)) {
+                            nrOfSteals++;
+                            job(jobNr, workerNr);
+                        } else {
+                            // No jobs are added while running, so all deques being empty means we are done.
+                            return;
+                        }
+                    }
+                });
+            }
+            for (std::thread &thread : threads) {
+                thread.join();
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,205 @@
+/*
+    Benchmark of the output lag and dropouts of the firmware, for PREDICTIVE_OUTPUT and for the
+    reactive output it replaces.
+
+    The module is the firmware itself (src/main.cpp with the options as defined there, plus
+    PREDICTIVE_OUTPUT unless BENCH_REACTIVE is defined) on the emulated ATmega328P of FirmwareHost.hpp,
+    in MULT with a factor of 1, so every clock edge should give exactly one output pulse. It is fed a
+    number of input clocks, each in a child process of its own:
+    - steady:  120 BPM,
+    - jitter:  120 BPM, every interval off by a normal random time with a deviation of 1%,
+    - swing:   120 BPM with 60% swing (600 mS, 400 mS, ...),
+    - slower:  120 BPM, then 92 BPM from beat 30 on, so the clock is late for the predicted beats,
+    - faster:  120 BPM, then 160 BPM from beat 30 on, so the clock is early for the predicted beats,
+    - ramp:    from 120 BPM to 200 BPM over 40 beats,
+    - stop:    120 BPM, stopped after beat 30.
+
+    Build (from the tools directory):
+        g++ -std=c++11 -O2 -Wall -Ifirmware_host -o bench_prediction bench_prediction.cpp
+        g++ -std=c++11 -O2 -Wall -Ifirmware_host -DBENCH_REACTIVE -o bench_reactive bench_prediction.cpp
+
+    Usage:
+        ./bench_prediction [clock]
+
+    Reported per clock, for the clock edges after the first 10 (the warm up):
+    - lag:     mean, mean absolute and max absolute time from the clock edge to the nearest rising
+               edge of CLOCK_OUT within half a beat (negative if the output was early),
+    - missing: clock edges without a rising edge of CLOCK_OUT within half a beat,
+    - extra:   rising edges of CLOCK_OUT beyond the first within half a beat of a clock edge,
+    - restart: beats started beyond the first within half a beat of a clock edge (PREDICTIVE_OUTPUT
+               only). A beat started while CLOCK_OUT is high gives no rising edge, so extra misses it.
+    - after:   rising edges of CLOCK_OUT more than half a beat after the last clock edge (the
+               flywheel beats when the clock stops; FLYWHEEL_BEATS for PREDICTIVE_OUTPUT).
+
+    The emulator runs every interrupt routine in zero time, so the lag is that of the design only:
+    on a module the run time of clockISR() (see REPORT_ISR_TIMING) adds to it.
+*/
+
+#ifndef BENCH_REACTIVE
+#define PREDICTIVE_OUTPUT
+#endif
+
+#include "FirmwareHost.hpp"
+#include "../src/main.cpp"
+#undef printf
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#define BENCH_BEAT_TIME       500000.0 // uS
+#define BENCH_BEATS           70
+#define BENCH_CHANGE_BEAT     30
+#define BENCH_WARM_UP_BEATS   10
+#define BENCH_START_TIME      3000000  // uS, after setup() and the first pot scans.
+#define BENCH_PULSE_WIDTH     5000     // uS
+#define BENCH_MULT_POT_VALUE  256      // Selects the second entry of potValues4Mult, i.e. a factor of 1.
+
+static const char *clockNames[] = { "steady", "jitter", "swing", "slower", "faster", "ramp", "stop" };
+#define NR_OF_CLOCKS (sizeof(clockNames) / sizeof(clockNames[0]))
+
+static std::vector<double> outputRises;
+static std::vector<double> beatStarts;
+
+static void onEdge(void *, uint64_t cycle, uint8_t pinNumber, bool level) {
+    if ((pinNumber == CLOCK_OUT) && level) {
+        outputRises.push_back((double) cycle / FIRMWARE_HOST_CYCLES_PER_US);
+    }
+}
+
+// The clock edges (in uS) of the named input clock.
+static std::vector<double> makeClock(const char *name) {
+    std::vector<double> edges;
+    std::mt19937 generator(1234);
+    std::normal_distribution<double> jitter(0.0, BENCH_BEAT_TIME / 100);
+    double time = BENCH_START_TIME;
+    for (int beat = 0; beat < BENCH_BEATS; beat++) {
+        edges.push_back(time);
+        double interval = BENCH_BEAT_TIME;
+        if (strcmp(name, "jitter") == 0) {
+            interval += jitter(generator);
+        } else if (strcmp(name, "swing") == 0) {
+            interval *= (beat % 2 == 0) ? 1.2 : 0.8;
+        } else if ((strcmp(name, "slower") == 0) && (beat >= BENCH_CHANGE_BEAT)) {
+            interval *= 1.3;
+        } else if ((strcmp(name, "faster") == 0) && (beat >= BENCH_CHANGE_BEAT)) {
+            interval *= 0.75;
+        } else if ((strcmp(name, "ramp") == 0) && (beat >= BENCH_CHANGE_BEAT)) {
+            interval *= 1.0 - 0.4 * fmin(beat - BENCH_CHANGE_BEAT, 40) / 40;
+        } else if ((strcmp(name, "stop") == 0) && (beat == BENCH_CHANGE_BEAT)) {
+            break;
+        }
+        time += interval;
+    }
+    return(edges);
+}
+
+static void runClock(const char *name) {
+    std::vector<double> edges = makeClock(name);
+    for (double edge : edges) {
+        uint64_t cycle = (uint64_t) edge * FIRMWARE_HOST_CYCLES_PER_US;
+        firmwareHost.scheduleInput(cycle, EXT_CLOCK_IN, HIGH);
+        firmwareHost.scheduleInput(cycle + BENCH_PULSE_WIDTH * FIRMWARE_HOST_CYCLES_PER_US, EXT_CLOCK_IN, LOW);
+    }
+    firmwareHost.setEdgeCallback(onEdge, nullptr);
+    firmwareHost.setAnalogValue(FREQ_POT_MPU, BENCH_MULT_POT_VALUE);
+    firmwareHost.setAnalogValue(FREQ_IN_MPU, 0);
+    firmwareHost.setAnalogValue(CHANCE_POT_MPU, 1023);
+    firmwareHost.setAnalogValue(CHANCE_IN_MPU, 0);
+    uint64_t endTime = (uint64_t) edges.back() + 10 * (uint64_t) BENCH_BEAT_TIME;
+#ifdef PREDICTIVE_OUTPUT
+    // Poll the beats started by the firmware, to the mS.
+    byte lastBeatNumber = beatNumber;
+    for (uint64_t time = 0; time < endTime; time += 1000) {
+        firmwareHost.runMicros(time);
+        for (; lastBeatNumber != beatNumber; lastBeatNumber++) {
+            beatStarts.push_back((double) firmwareHost.nowMicros());
+        }
+    }
+#else
+    firmwareHost.runMicros(endTime);
+#endif
+
+    double lagSum = 0;
+    double absLagSum = 0;
+    double maxAbsLag = 0;
+    int lags = 0;
+    int missing = 0;
+    int extra = 0;
+    int restarts = 0;
+    for (size_t edgeNr = BENCH_WARM_UP_BEATS; edgeNr < edges.size(); edgeNr++) {
+        double from = edges[edgeNr] - (edges[edgeNr] - edges[edgeNr - 1]) / 2;
+        double to = (edgeNr + 1 < edges.size()) ? edges[edgeNr] + (edges[edgeNr + 1] - edges[edgeNr]) / 2
+                                                 : edges[edgeNr] + (edges[edgeNr] - edges[edgeNr - 1]) / 2;
+        int starts = 0;
+        for (double start : beatStarts) {
+            if ((start >= from) && (start < to)) {
+                starts++;
+            }
+        }
+        if (starts > 1) {
+            restarts += starts - 1;
+        }
+        int rises = 0;
+        double lag = 0;
+        for (double rise : outputRises) {
+            if ((rise >= from) && (rise < to)) {
+                if ((rises == 0) || (fabs(rise - edges[edgeNr]) < fabs(lag))) {
+                    lag = rise - edges[edgeNr];
+                }
+                rises++;
+            }
+        }
+        if (rises == 0) {
+            missing++;
+            continue;
+        }
+        extra += rises - 1;
+        lagSum += lag;
+        absLagSum += fabs(lag);
+        maxAbsLag = fmax(maxAbsLag, fabs(lag));
+        lags++;
+    }
+    double lastEnd = edges.back() + (edges.back() - edges[edges.size() - 2]) / 2;
+    int after = 0;
+    for (double rise : outputRises) {
+        if (rise >= lastEnd) {
+            after++;
+        }
+    }
+    printf("%-8s %10.0f %10.0f %10.0f %8d %8d", name, lags ? lagSum / lags : 0.0, lags ? absLagSum / lags : 0.0,
+           maxAbsLag, missing, extra);
+#ifdef PREDICTIVE_OUTPUT
+    printf(" %8d", restarts);
+#else
+    printf(" %8s", "-");
+#endif
+    printf(" %8d\n", after);
+}
+
+int main(int argc, char **argv) {
+#ifdef PREDICTIVE_OUTPUT
+    printf("PREDICTIVE_OUTPUT\n");
+#else
+    printf("reactive output\n");
+#endif
+    printf("%-8s %10s %10s %10s %8s %8s %8s %8s\n", "clock", "lag uS", "|lag| uS", "max uS", "missing", "extra", "restart", "after");
+    fflush(stdout);
+    for (size_t clockNr = 0; clockNr < NR_OF_CLOCKS; clockNr++) {
+        if ((argc > 1) && (strcmp(argv[1], clockNames[clockNr]) != 0)) {
+            continue;
+        }
+        // The firmware keeps its state in globals, so every clock gets a fresh module.
+        pid_t child = fork();
+        if (child == 0) {
+            runClock(clockNames[clockNr]);
+            fflush(stdout);
+            _exit(0);
+        }
+        waitpid(child, nullptr, 0);
+    }
+    return(0);
+}
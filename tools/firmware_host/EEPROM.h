@@ -0,0 +1,56 @@
+#ifndef _HOST_EEPROM_H
+#define _HOST_EEPROM_H
+
+// Stub for host builds of the firmware, see ../FirmwareHost.hpp: an erased EEPROM in memory.
+
+#include <string.h>
+#include "../FirmwareHost.hpp"
+
+#define HOST_EEPROM_SIZE 1024
+
+class EEPROMClass {
+
+    private:
+        uint8_t memory[HOST_EEPROM_SIZE];
+
+    public:
+        EEPROMClass() {
+            memset(memory, 0xFF, sizeof(memory));
+        }
+
+        unsigned int length() {
+            return(HOST_EEPROM_SIZE);
+        }
+
+        uint8_t read(int address) {
+            return(memory[address % HOST_EEPROM_SIZE]);
+        }
+
+        void write(int address, uint8_t value) {
+            memory[address % HOST_EEPROM_SIZE] = value;
+        }
+
+        void update(int address, uint8_t value) {
+            write(address, value);
+        }
+
+        template <typename T> T &get(int address, T &value) {
+            uint8_t *bytes = (uint8_t *)&value;
+            for (unsigned int index = 0; index < sizeof(T); index++) {
+                bytes[index] = read(address + index);
+            }
+            return(value);
+        }
+
+        template <typename T> const T &put(int address, const T &value) {
+            const uint8_t *bytes = (const uint8_t *)&value;
+            for (unsigned int index = 0; index < sizeof(T); index++) {
+                write(address + index, bytes[index]);
+            }
+            return(value);
+        }
+};
+
+EEPROMClass EEPROM;
+
+#endif
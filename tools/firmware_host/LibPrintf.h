@@ -0,0 +1,6 @@
+// Stub for host builds of the firmware, see ../FirmwareHost.hpp: printf() goes to the serial output of the host.
+#include "../FirmwareHost.hpp"
+
+#ifndef printf
+    #define printf(...) hostSerialPrintf(__VA_ARGS__)
+#endif
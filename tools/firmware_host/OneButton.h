@@ -0,0 +1,58 @@
+#ifndef _HOST_ONE_BUTTON_H
+#define _HOST_ONE_BUTTON_H
+
+// Stub for host builds of the firmware, see ../FirmwareHost.hpp. A host tool presses the button
+// with click() and doubleClick(), which call the attached handlers right away.
+
+#include "../FirmwareHost.hpp"
+
+typedef void (*callbackFunction)(void);
+
+class OneButton {
+
+    private:
+        callbackFunction clickFunction = nullptr;
+        callbackFunction doubleClickFunction = nullptr;
+        callbackFunction longPressStartFunction = nullptr;
+
+    public:
+        OneButton(int pin, bool activeLow = true, bool pullupActive = true) {
+            (void)pin;
+            (void)activeLow;
+            (void)pullupActive;
+        }
+
+        void attachClick(callbackFunction function) {
+            clickFunction = function;
+        }
+
+        void attachDoubleClick(callbackFunction function) {
+            doubleClickFunction = function;
+        }
+
+        void attachLongPressStart(callbackFunction function) {
+            longPressStartFunction = function;
+        }
+
+        void tick() {}
+
+        void click() {
+            if (clickFunction != nullptr) {
+                clickFunction();
+            }
+        }
+
+        void doubleClick() {
+            if (doubleClickFunction != nullptr) {
+                doubleClickFunction();
+            }
+        }
+
+        void longPress() {
+            if (longPressStartFunction != nullptr) {
+                longPressStartFunction();
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef _HOST_TIMER_ONE_H
+#define _HOST_TIMER_ONE_H
+
+/*
+    Host build of the TimerOne library (ATmega328P part), see ../FirmwareHost.hpp. It programs the
+    emulated Timer1 the way the library does: phase and frequency correct PWM with TOP in ICR1, so
+    the period is twice the given time, and the overflow interrupt at BOTTOM. start() writes
+    TCNT1 = 0, so the first overflow interrupt follows one timer clock after start(), as the
+    datasheet describes the counter leaving BOTTOM. That detail is taken from the datasheet and
+    the library source, not measured on a module.
+*/
+
+#include "../FirmwareHost.hpp"
+
+#define TIMER1_RESOLUTION 65536UL
+
+class TimerOne {
+
+    private:
+        uint8_t clockSelectBits = 0;
+        void (*isrCallback)(void) = nullptr;
+
+    public:
+        void initialize(unsigned long microseconds = 1000000) {
+            TCCR1B = _BV(WGM13); // Phase and frequency correct PWM, timer stopped.
+            TCCR1A = 0;
+            setPeriod(microseconds);
+        }
+
+        void setPeriod(unsigned long microseconds) {
+            const unsigned long cycles = (F_CPU / 2000000) * microseconds;
+            unsigned long pwmPeriod;
+            if (cycles < TIMER1_RESOLUTION) {
+                clockSelectBits = _BV(CS10);
+                pwmPeriod = cycles;
+            } else if (cycles < TIMER1_RESOLUTION * 8) {
+                clockSelectBits = _BV(CS11);
+                pwmPeriod = cycles / 8;
+            } else if (cycles < TIMER1_RESOLUTION * 64) {
+                clockSelectBits = _BV(CS11) | _BV(CS10);
+                pwmPeriod = cycles / 64;
+            } else if (cycles < TIMER1_RESOLUTION * 256) {
+                clockSelectBits = _BV(CS12);
+                pwmPeriod = cycles / 256;
+            } else if (cycles < TIMER1_RESOLUTION * 1024) {
+                clockSelectBits = _BV(CS12) | _BV(CS10);
+                pwmPeriod = cycles / 1024;
+            } else {
+                clockSelectBits = _BV(CS12) | _BV(CS10);
+                pwmPeriod = TIMER1_RESOLUTION - 1;
+            }
+            ICR1 = pwmPeriod;
+            TCCR1B = _BV(WGM13) | clockSelectBits;
+        }
+
+        void start() {
+            TCCR1B = 0;
+            TCNT1 = 0;
+            resume();
+        }
+
+        void stop() {
+            TCCR1B = _BV(WGM13);
+        }
+
+        void restart() {
+            start();
+        }
+
+        void resume() {
+            TCCR1B = _BV(WGM13) | clockSelectBits;
+        }
+
+        void attachInterrupt(void (*isr)(void)) {
+            isrCallback = isr;
+            TIMSK1 = _BV(TOIE1);
+        }
+
+        void attachInterrupt(void (*isr)(void), unsigned long microseconds) {
+            if (microseconds > 0) {
+                setPeriod(microseconds);
+            }
+            attachInterrupt(isr);
+        }
+
+        void detachInterrupt() {
+            TIMSK1 = 0;
+        }
+
+        void callback() {
+            if (isrCallback != nullptr) {
+                isrCallback();
+            }
+        }
+};
+
+TimerOne Timer1;
+
+ISR(TIMER1_OVF_vect) {
+    Timer1.callback();
+}
+
+#endif
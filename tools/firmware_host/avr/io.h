@@ -0,0 +1,2 @@
+// Stub for host builds of the firmware, see ../../FirmwareHost.hpp.
+#include "../../FirmwareHost.hpp"
@@ -0,0 +1,504 @@
+/*
+    Replays a logic analyzer capture of a real clock (and reset) through the RatchetEngine and writes
+    the resulting CLOCK_OUT next to the inputs, so tempo tracking and bursts can be checked against real
+    jitter by overlaying the result on the capture in a waveform viewer (e.g. PulseView).
+
+    Build (from the tools directory):
+        g++ -std=c++11 -O2 -Wall -I../src -o replay_capture replay_capture.cpp
+
+    Usage:
+        ./replay_capture [options] capture.csv output.csv
+        -c column   clock column, by name or number (default: the first logic column)
+        -r column   reset column, by name or number (default: none)
+        -R rate     sample rate in Hz when there is no time column and no "Samplerate" comment
+        -m mode     mult, div or maxmult (default mult)
+        -f factor   ratchets (mult), division (div) or maximum ratchets (maxmult) (default 3)
+        -p chance   chance in percent (default 100)
+        -l latency  interrupt latency of the burst timer in uS (default 0)
+        -s seed     seed of the random number generator (default 0)
+        -i          act on falling instead of rising edges
+
+    Two kinds of CSV are understood:
+    - sigrok-cli -O csv: ';' comment lines (with "Samplerate: 1 MHz"), a header line and one row per sample,
+    - exports with a time column ("Time [s]", "[ms]", "[us]" or "[ns]") and a row per change, like the
+      logic analyzer software of Saleae writes them.
+    The output has the same comments, time column (if any), the clock and reset columns and an extra
+    CLOCK_OUT column. Without a time column there is one output row per input row. With a time column
+    rows are added for every CLOCK_OUT edge in between.
+
+    The capture is memory mapped and read once from front to back, so captures much larger than the
+    memory can be replayed. The engine works in uS, like micros() on the module.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "HostRatchetHal.hpp"
+#include "RatchetEngine.hpp"
+
+#define CLOCK_OUT_PIN 5
+#define MAX_NR_OF_COLUMNS 64
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+// A pending CLOCK_OUT edge, reported by the engine but not yet written.
+struct Edge {
+    int64_t time;     // nS
+    bool level;
+};
+
+struct Replay {
+    std::vector<Edge> edges;
+    int64_t lastTime = 0; // nS, the time the engine has been run up to.
+    bool level = false;   // CLOCK_OUT after all edges reported so far.
+};
+
+// The engine reports uS times which wrap after 71 minutes; extend them to nS relative to the run time.
+void onEdge(void *context, uint32_t time, uint8_t pinNumber, bool level) {
+    Replay *replay = (Replay *)context;
+    if (pinNumber != CLOCK_OUT_PIN) {
+        return;
+    }
+    int64_t lastMicros = replay->lastTime / 1000;
+    int64_t micros = lastMicros + (int32_t)(time - (uint32_t)lastMicros);
+    replay->edges.push_back({ micros * 1000, level });
+    replay->level = level;
+}
+
+// A buffered output file, which is flushed and closed when the OutputFile goes.
+class OutputFile {
+
+    private:
+        FILE *file;
+        std::vector<char> buffer;
+        size_t used = 0;
+
+    public:
+        explicit OutputFile(FILE *someFile): file(someFile), buffer(OUTPUT_BUFFER_SIZE) { }
+
+        ~OutputFile() {
+            flush();
+            fclose(file);
+        }
+
+        OutputFile(const OutputFile &) = delete;
+        OutputFile &operator=(const OutputFile &) = delete;
+
+        void flush() {
+            fwrite(buffer.data(), 1, used, file);
+            used = 0;
+        }
+
+        void write(const char *text, size_t length) {
+            if (used + length > OUTPUT_BUFFER_SIZE) {
+                flush();
+            }
+            memcpy(buffer.data() + used, text, length);
+            used += length;
+        }
+
+        void write(const char *text) {
+            write(text, strlen(text));
+        }
+
+        void write(char character) {
+            if (used + 1 > OUTPUT_BUFFER_SIZE) {
+                flush();
+            }
+            buffer[used++] = character;
+        }
+
+        // A time in units of 10^-decimals, printed with that number of decimals.
+        void writeTime(int64_t time, int decimals) {
+            char digits[32];
+            int nrOfDigits = 0;
+            bool negative = time < 0;
+            uint64_t value = negative ? -time : time;
+            do {
+                digits[nrOfDigits++] = '0' + value % 10;
+                value /= 10;
+                if (nrOfDigits == decimals) {
+                    digits[nrOfDigits++] = '.';
+                }
+            } while ((value > 0) || ((decimals > 0) && (nrOfDigits <= decimals + 1))); // E.g. 0.005, but 5.
+            if (negative) {
+                write('-');
+            }
+            while (nrOfDigits > 0) {
+                write(digits[--nrOfDigits]);
+            }
+        }
+};
+
+// A field of the current line, not terminated.
+struct Field {
+    const char *start;
+    const char *end;
+
+    bool is(const char *text) const {
+        size_t length = strlen(text);
+        return(((size_t)(end - start) == length) && (memcmp(start, text, length) == 0));
+    }
+
+    bool isHigh() const {
+        // Logic columns are 0 or 1; anything else is compared with 0.5.
+        if (end - start == 1) {
+            return(*start != '0');
+        }
+        return(strtod(std::string(start, end).c_str(), nullptr) > 0.5);
+    }
+};
+
+const char *skipSpaces(const char *position, const char *end) {
+    while ((position < end) && ((*position == ' ') || (*position == '\t') || (*position == '"'))) {
+        position++;
+    }
+    return(position);
+}
+
+// Split the line at position into fields. Returns the start of the next line.
+const char *splitLine(const char *position, const char *end, Field *fields, int *nrOfFields) {
+    *nrOfFields = 0;
+    const char *lineEnd = (const char *)memchr(position, '\n', end - position);
+    if (lineEnd == nullptr) {
+        lineEnd = end;
+    }
+    const char *fieldStart = position;
+    while (true) {
+        const char *fieldEnd = fieldStart;
+        while ((fieldEnd < lineEnd) && (*fieldEnd != ',')) {
+            fieldEnd++;
+        }
+        if (*nrOfFields < MAX_NR_OF_COLUMNS) {
+            const char *start = skipSpaces(fieldStart, fieldEnd);
+            const char *stop = fieldEnd;
+            while ((stop > start) && ((stop[-1] == ' ') || (stop[-1] == '\r') || (stop[-1] == '"'))) {
+                stop--;
+            }
+            fields[(*nrOfFields)++] = { start, stop };
+        }
+        if (fieldEnd >= lineEnd) {
+            break;
+        }
+        fieldStart = fieldEnd + 1;
+    }
+    return((lineEnd < end) ? lineEnd + 1 : end);
+}
+
+// Parse a decimal time to nS, without going through a double for the common case.
+int64_t parseTime(const Field &field, int64_t nanosPerUnit) {
+    const char *position = field.start;
+    bool negative = (position < field.end) && (*position == '-');
+    if (negative) {
+        position++;
+    }
+    int64_t whole = 0;
+    while ((position < field.end) && (*position >= '0') && (*position <= '9')) {
+        whole = whole * 10 + (*position++ - '0');
+    }
+    int64_t fraction = 0;
+    int64_t scale = nanosPerUnit;
+    if ((position < field.end) && (*position == '.')) {
+        position++;
+        while ((position < field.end) && (*position >= '0') && (*position <= '9')) {
+            if (scale >= 10) {
+                scale /= 10;
+                fraction += (*position - '0') * scale;
+            }
+            position++;
+        }
+    }
+    if (position < field.end) { // An exponent or something else unexpected.
+        return((int64_t)(strtod(std::string(field.start, field.end).c_str(), nullptr) * nanosPerUnit));
+    }
+    int64_t time = whole * nanosPerUnit + fraction;
+    return(negative ? -time : time);
+}
+
+// Find a column by name or by number.
+int findColumn(const char *name, const Field *header, int nrOfColumns) {
+    for (int columnNr = 0; columnNr < nrOfColumns; columnNr++) {
+        if (header[columnNr].is(name)) {
+            return(columnNr);
+        }
+    }
+    char *end;
+    long columnNr = strtol(name, &end, 10);
+    if ((*end == '\0') && (columnNr >= 0) && (columnNr < nrOfColumns)) {
+        return(columnNr);
+    }
+    return(-1);
+}
+
+// "; Samplerate: 1 MHz" -> 1000000
+double parseSampleRate(const char *position, const char *end) {
+    std::string line(position, end);
+    size_t colon = line.find("amplerate:");
+    if (colon == std::string::npos) {
+        return(0.0);
+    }
+    char *unit;
+    double rate = strtod(line.c_str() + colon + 10, &unit);
+    while (*unit == ' ') {
+        unit++;
+    }
+    if (*unit == 'k') {
+        rate *= 1e3;
+    } else if (*unit == 'M') {
+        rate *= 1e6;
+    } else if (*unit == 'G') {
+        rate *= 1e9;
+    }
+    return(rate);
+}
+
+void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-c clock] [-r reset] [-R rate] [-m mult|div|maxmult] [-f factor] [-p chance]"
+        " [-l latency] [-s seed] [-i] capture.csv output.csv\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    const char *clockName = nullptr;
+    const char *resetName = nullptr;
+    double sampleRate = 0.0;
+    uint8_t mode = CHANNEL_MULT;
+    uint8_t factor = 3;
+    uint8_t chance = 100;
+    uint32_t latency = 0;
+    long seed = 0;
+    bool activeLevel = true;
+    std::vector<const char *> fileNames;
+    for (int argCnt = 1; argCnt < argc; argCnt++) {
+        const char *argument = argv[argCnt];
+        bool hasValue = argCnt + 1 < argc;
+        if ((strcmp(argument, "-c") == 0) && hasValue) {
+            clockName = argv[++argCnt];
+        } else if ((strcmp(argument, "-r") == 0) && hasValue) {
+            resetName = argv[++argCnt];
+        } else if ((strcmp(argument, "-R") == 0) && hasValue) {
+            sampleRate = atof(argv[++argCnt]);
+        } else if ((strcmp(argument, "-m") == 0) && hasValue) {
+            const char *modeName = argv[++argCnt];
+            if (strcmp(modeName, "mult") == 0) {
+                mode = CHANNEL_MULT;
+            } else if (strcmp(modeName, "div") == 0) {
+                mode = CHANNEL_DIV;
+            } else if (strcmp(modeName, "maxmult") == 0) {
+                mode = CHANNEL_MAX_MULT;
+            } else {
+                usage(argv[0]);
+                return(1);
+            }
+        } else if ((strcmp(argument, "-f") == 0) && hasValue) {
+            factor = atoi(argv[++argCnt]);
+        } else if ((strcmp(argument, "-p") == 0) && hasValue) {
+            chance = atoi(argv[++argCnt]);
+        } else if ((strcmp(argument, "-l") == 0) && hasValue) {
+            latency = atoi(argv[++argCnt]);
+        } else if ((strcmp(argument, "-s") == 0) && hasValue) {
+            seed = atol(argv[++argCnt]);
+        } else if (strcmp(argument, "-i") == 0) {
+            activeLevel = false;
+        } else if (argument[0] == '-') {
+            usage(argv[0]);
+            return(1);
+        } else {
+            fileNames.push_back(argument);
+        }
+    }
+    if (fileNames.size() != 2) {
+        usage(argv[0]);
+        return(1);
+    }
+
+    int fileDescriptor = open(fileNames[0], O_RDONLY);
+    struct stat fileStatus;
+    if ((fileDescriptor < 0) || (fstat(fileDescriptor, &fileStatus) != 0)) {
+        perror(fileNames[0]);
+        return(1);
+    }
+    size_t size = fileStatus.st_size;
+    const char *data = (const char *)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return(1);
+    }
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+    const char *end = data + size;
+    FILE *outputFile = fopen(fileNames[1], "w");
+    if (outputFile == nullptr) {
+        perror(fileNames[1]);
+        return(1);
+    }
+    OutputFile output(outputFile);
+
+    // Comments, which are copied, and the header.
+    const char *position = data;
+    Field header[MAX_NR_OF_COLUMNS];
+    int nrOfColumns = 0;
+    while (position < end) {
+        const char *lineEnd = (const char *)memchr(position, '\n', end - position);
+        lineEnd = lineEnd ? lineEnd : end;
+        if (*position == ';') {
+            if (sampleRate == 0.0) {
+                sampleRate = parseSampleRate(position, lineEnd);
+            }
+            output.write(position, lineEnd - position);
+            output.write('\n');
+            position = (lineEnd < end) ? lineEnd + 1 : end;
+        } else if (lineEnd == position) {
+            position++;
+        } else {
+            position = splitLine(position, end, header, &nrOfColumns);
+            break;
+        }
+    }
+
+    int timeColumn = -1;
+    int64_t nanosPerUnit = 0;
+    int decimals = 0;
+    int64_t nanosPerStep = 0;  // nS per step of the last decimal of the CLOCK_OUT edge times.
+    if ((nrOfColumns > 0) && (header[0].end - header[0].start >= 4) && (memcmp(header[0].start, "Time", 4) == 0)) {
+        timeColumn = 0;
+        std::string name(header[0].start, header[0].end);
+        if (name.find("[ms]") != std::string::npos) {
+            nanosPerUnit = 1000000;
+        } else if (name.find("[us]") != std::string::npos) {
+            nanosPerUnit = 1000;
+        } else if (name.find("[ns]") != std::string::npos) {
+            nanosPerUnit = 1;
+        } else {
+            nanosPerUnit = 1000000000;
+        }
+        nanosPerStep = nanosPerUnit;
+        // Enough decimals for the uS resolution of the engine.
+        for (int64_t unit = nanosPerUnit; unit > 1000; unit /= 10) {
+            decimals++;
+            nanosPerStep /= 10;
+        }
+    } else if (sampleRate <= 0.0) {
+        fprintf(stderr, "no time column and no sample rate, use -R\n");
+        return(1);
+    }
+    int clockColumn = clockName ? findColumn(clockName, header, nrOfColumns) : timeColumn + 1;
+    int resetColumn = resetName ? findColumn(resetName, header, nrOfColumns) : -1;
+    if ((clockColumn < 0) || (clockColumn >= nrOfColumns) || (clockColumn == timeColumn) || (resetName && (resetColumn < 0))) {
+        fprintf(stderr, "clock or reset column not found\n");
+        return(1);
+    }
+
+    if (timeColumn >= 0) {
+        output.write(header[timeColumn].start, header[timeColumn].end - header[timeColumn].start);
+        output.write(',');
+    }
+    output.write(header[clockColumn].start, header[clockColumn].end - header[clockColumn].start);
+    if (resetColumn >= 0) {
+        output.write(',');
+        output.write(header[resetColumn].start, header[resetColumn].end - header[resetColumn].start);
+    }
+    output.write(",CLOCK_OUT\n");
+
+    Replay replay;
+    HostRatchetHal hal;
+    hal.setEdgeCallback(onEdge, &replay);
+    hal.setLatency(latency);
+    LFSR_RandomNumberGenerator randomNumberGenerator(seed);
+    RatchetEngine<HostRatchetHal> engine(&hal, &randomNumberGenerator);
+    uint8_t channelNr = engine.addChannel(CLOCK_OUT_PIN, mode, (mode == CHANNEL_MAX_MULT) ? 1 : factor, chance);
+    engine.getChannel(channelNr)->maxFactor = factor;
+
+    auto startTime = std::chrono::steady_clock::now();
+    const char *firstRow = position;
+    Field fields[MAX_NR_OF_COLUMNS];
+    int nrOfFields;
+    uint64_t nrOfRows = 0;
+    uint64_t nrOfClockEdges = 0;
+    uint64_t nrOfResetEdges = 0;
+    uint64_t nrOfOutputEdges = 0;
+    int64_t firstTime = 0;
+    int64_t time = 0;
+    bool clockLevel = false; // The levels of the first row, so that row is no edge.
+    bool resetLevel = false;
+    while (position < end) {
+        if ((*position == '\n') || (*position == '\r') || (*position == ';')) {
+            const char *lineEnd = (const char *)memchr(position, '\n', end - position);
+            position = lineEnd ? lineEnd + 1 : end;
+            continue;
+        }
+        position = splitLine(position, end, fields, &nrOfFields);
+        if ((nrOfFields <= clockColumn) || (nrOfFields <= resetColumn) || (nrOfFields <= timeColumn)) {
+            continue;
+        }
+        time = (timeColumn >= 0) ? parseTime(fields[timeColumn], nanosPerUnit) : (int64_t)(nrOfRows * 1e9 / sampleRate);
+        if (nrOfRows == 0) {
+            firstTime = time;
+            replay.lastTime = time;
+            hal.setTime((uint32_t)(time / 1000));
+            clockLevel = fields[clockColumn].isHigh();
+            resetLevel = (resetColumn >= 0) ? fields[resetColumn].isHigh() : !activeLevel;
+        }
+        nrOfRows++;
+
+        // Let the engine catch up, writing a row for every CLOCK_OUT edge before this row.
+        hal.runUntil(&engine, (uint32_t)(time / 1000));
+        replay.lastTime = time;
+        for (const Edge &edge : replay.edges) {
+            nrOfOutputEdges++;
+            if ((timeColumn >= 0) && (edge.time < time)) {
+                output.writeTime(edge.time / nanosPerStep, decimals);
+                output.write(clockLevel ? ",1" : ",0");
+                if (resetColumn >= 0) {
+                    output.write(resetLevel ? ",1" : ",0");
+                }
+                output.write(edge.level ? ",1\n" : ",0\n");
+            }
+        }
+        replay.edges.clear();
+
+        // The inputs of this row.
+        bool newClockLevel = fields[clockColumn].isHigh();
+        bool newResetLevel = (resetColumn >= 0) ? fields[resetColumn].isHigh() : resetLevel;
+        uint32_t micros = (uint32_t)(time / 1000);
+        if ((newResetLevel != resetLevel) && (newResetLevel == activeLevel)) {
+            nrOfResetEdges++;
+            engine.stopBursts();
+            engine.reset(micros);
+        }
+        if ((newClockLevel != clockLevel) && (newClockLevel == activeLevel)) {
+            nrOfClockEdges++;
+            engine.stopBursts();
+            engine.clockEdge(micros);
+        }
+        clockLevel = newClockLevel;
+        resetLevel = newResetLevel;
+        nrOfOutputEdges += replay.edges.size();
+        replay.edges.clear();
+
+        if (timeColumn >= 0) {
+            output.write(fields[timeColumn].start, fields[timeColumn].end - fields[timeColumn].start);
+            output.write(',');
+        }
+        output.write(clockLevel ? '1' : '0');
+        if (resetColumn >= 0) {
+            output.write(resetLevel ? ",1" : ",0");
+        }
+        output.write(replay.level ? ",1\n" : ",0\n");
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    double captureSeconds = (time - firstTime) / 1e9;
+    munmap((void *)data, size);
+
+    fprintf(stderr, "%lu rows, %.3f s of capture, %lu clock edges, %lu reset edges, %lu CLOCK_OUT edges\n",
+        (unsigned long)nrOfRows, captureSeconds, (unsigned long)nrOfClockEdges, (unsigned long)nrOfResetEdges,
+        (unsigned long)nrOfOutputEdges);
+    fprintf(stderr, "last beat %u uS, detected pattern length %u\n", engine.getBeatTime(), engine.getTempo()->getPatternLength());
+    fprintf(stderr, "%.2f s, %.0f MB/s, %.0f x real time\n", elapsed, (end - firstRow) / elapsed / 1e6,
+        (elapsed > 0) ? captureSeconds / elapsed : 0.0);
+    return(0);
+}
@@ -0,0 +1,479 @@
+/*
+    Statistical quality suite for LFSR_RandomNumberGenerator (RandomNumberGenerator.hpp).
+
+    The firmware draws the chance with getRandomNumber(0, 100, SEVEN_BITS) and the number of ratchets of
+    MAX_MULT with getRandomNumber(min, max + 1, FOUR_BITS). Both take a value of a few bits modulo the size
+    of the range, which is only uniform when the size is a power of 2. This tool measures what the
+    module really does: per seed and bit width it draws up to a full period of the LFSR and reports
+    - the effective probability of every value and, for 0 ... 99, of every chance knob setting,
+    - chi-square of the raw bits (the generator itself) and of the values (the generator plus modulo),
+    - a runs test (below / above half of the range) and the serial correlation at lags 1 ... NR_OF_LAGS.
+
+    Build (from the tools directory):
+        g++ -std=c++11 -O3 -march=native -Wall -pthread -I../src -o rng_quality rng_quality.cpp
+
+    Usage:
+        ./rng_quality [-d draws per configuration, 0 = one period] [-t threads] [-s seed,seed,...] [-v]
+
+    The LFSR is linear over GF(2), so n steps are a 32 x 32 bit matrix M^n. The stream of every
+    configuration is cut into NR_OF_LANES segments per job, and the start of every segment is found by
+    jumping ahead with that matrix instead of stepping to it. The segments of a job are stepped together
+    bit-sliced: bit k of the 64 states lives in one 64 bit word, so one step of all 64 LFSRs is three
+    XORs, and the output bits are turned back into values with 8 x 8 bit transposes. Before measuring,
+    the tool checks the matrix, the jump and the bit-sliced draws against the real class.
+
+    Statistics are computed per segment; the few pairs across segment boundaries are left out. Over
+    exactly one period every raw value of n bits occurs 2^(32 - n) times (zero once less), so the raw
+    chi-square is then far below its expectation: the generator is too uniform rather than biased.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include "RandomNumberGenerator.hpp"
+#include "WorkStealingPool.hpp"
+
+#define NR_OF_LANES 64
+#define NR_OF_LAGS 8
+#define MAX_NR_OF_BITS 16
+#define CHUNKS_PER_CONFIGURATION 32
+#define LFSR_PERIOD 0xFFFFFFFFull // Taps 32, 22, 2, 1: a maximal length LFSR, checked at start up.
+#define SEED_OFFSET 0x12345678u   // LFSR_RandomNumberGenerator::init() adds the seed to this.
+
+// A 32 x 32 matrix over GF(2). Column j is the image of state bit j.
+struct BitMatrix {
+    uint32_t columns[32];
+
+    uint32_t apply(uint32_t state) const {
+        uint32_t result = 0;
+        for (int bitNr = 0; bitNr < 32; bitNr++) {
+            if (state & (1u << bitNr)) {
+                result ^= columns[bitNr];
+            }
+        }
+        return(result);
+    }
+
+    BitMatrix operator*(const BitMatrix &other) const {
+        BitMatrix result;
+        for (int bitNr = 0; bitNr < 32; bitNr++) {
+            result.columns[bitNr] = apply(other.columns[bitNr]);
+        }
+        return(result);
+    }
+
+    bool isIdentity() const {
+        for (int bitNr = 0; bitNr < 32; bitNr++) {
+            if (columns[bitNr] != (1u << bitNr)) {
+                return(false);
+            }
+        }
+        return(true);
+    }
+
+    BitMatrix power(uint64_t exponent) const {
+        BitMatrix result = identity();
+        BitMatrix square = *this;
+        while (exponent > 0) {
+            if (exponent & 1) {
+                result = result * square;
+            }
+            square = square * square;
+            exponent >>= 1;
+        }
+        return(result);
+    }
+
+    static BitMatrix identity() {
+        BitMatrix result;
+        for (int bitNr = 0; bitNr < 32; bitNr++) {
+            result.columns[bitNr] = 1u << bitNr;
+        }
+        return(result);
+    }
+
+    // One step of LFSR_RandomNumberGenerator::getBit(): shift right, feed bits 0, 10, 30 and 31 back into bit 31.
+    static BitMatrix step() {
+        BitMatrix result;
+        for (int bitNr = 0; bitNr < 32; bitNr++) {
+            result.columns[bitNr] = (bitNr > 0) ? (1u << (bitNr - 1)) : 0;
+            if ((bitNr == 0) || (bitNr == 10) || (bitNr == 30) || (bitNr == 31)) {
+                result.columns[bitNr] |= 1u << 31;
+            }
+        }
+        return(result);
+    }
+};
+
+// The same step on a plain state, to check the matrix and the bit-sliced stepping.
+uint32_t stepState(uint32_t state) {
+    uint32_t bit = ((state >> 0) ^ (state >> 10) ^ (state >> 30) ^ (state >> 31)) & 1;
+    return((state >> 1) | (bit << 31));
+}
+
+// Transpose an 8 x 8 bit matrix, with row r in byte r and column c in bit c of that byte.
+inline uint64_t transpose8(uint64_t x) {
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAull;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCull;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ull;
+    x = x ^ t ^ (t << 28);
+    return(x);
+}
+
+// NR_OF_LANES LFSRs, bit-sliced: bit k of lane l is bit l of words[(head + k) % 32].
+class SlicedLfsr {
+
+    private:
+        uint64_t words[32];
+        unsigned head = 0;
+
+        inline uint64_t step() {
+            uint64_t feedback = words[head] ^ words[(head + 10) & 31] ^ words[(head + 30) & 31] ^ words[(head + 31) & 31];
+            words[head] = feedback; // The old bit 0 slot becomes bit 31.
+            head = (head + 1) & 31;
+            return(words[head]);    // getBit() returns bit 0 after the step.
+        }
+
+    public:
+        void load(const uint32_t states[NR_OF_LANES]) {
+            head = 0;
+            for (int bitNr = 0; bitNr < 32; bitNr++) {
+                uint64_t word = 0;
+                for (int lane = 0; lane < NR_OF_LANES; lane++) {
+                    word |= (uint64_t)((states[lane] >> bitNr) & 1) << lane;
+                }
+                words[bitNr] = word;
+            }
+        }
+
+        // Like rand(nrOfBits) for every lane: the first bit drawn is the most significant one.
+        void draw(int nrOfBits, uint16_t values[NR_OF_LANES]) {
+            uint64_t outputs[MAX_NR_OF_BITS] = { 0 }; // outputs[n]: bit of weight 2^n of every lane.
+            for (int bitNr = nrOfBits - 1; bitNr >= 0; bitNr--) {
+                outputs[bitNr] = step();
+            }
+            memset(values, 0, NR_OF_LANES * sizeof(uint16_t));
+            for (int group = 0; group * 8 < nrOfBits; group++) {
+                for (int laneGroup = 0; laneGroup < NR_OF_LANES / 8; laneGroup++) {
+                    uint64_t block = 0;
+                    for (int row = 0; row < 8; row++) {
+                        block |= ((outputs[group * 8 + row] >> (laneGroup * 8)) & 0xFF) << (row * 8);
+                    }
+                    block = transpose8(block);
+                    for (int lane = 0; lane < 8; lane++) {
+                        values[laneGroup * 8 + lane] |= ((block >> (lane * 8)) & 0xFF) << (group * 8);
+                    }
+                }
+            }
+        }
+};
+
+struct Configuration {
+    long seed;
+    int nrOfBits;
+    int limit;                       // getRandomNumber(0, limit, nrOfBits)
+    uint64_t drawsPerLane;
+    BitMatrix laneJump;              // M^(drawsPerLane * nrOfBits)
+    std::vector<uint16_t> reduced;   // raw value % limit
+
+    // Totals over all jobs.
+    std::mutex mutex;
+    std::vector<uint64_t> rawCounts;
+    uint64_t nrOfDraws = 0;
+    uint64_t nrOfSegments = 0;
+    uint64_t nrOfLow = 0;
+    uint64_t nrOfChanges = 0;
+    double sum = 0;
+    double sumOfSquares = 0;
+    double lagSums[NR_OF_LAGS] = { 0 };
+    uint64_t lagPairs[NR_OF_LAGS] = { 0 };
+    double seconds = 0;
+};
+
+// Run the segments of chunk chunkNr of a configuration.
+void runChunk(Configuration *configuration, uint64_t chunkNr) {
+    auto startTime = std::chrono::steady_clock::now();
+    const int limit = configuration->limit;
+    const int half = limit / 2;
+    const uint16_t *reduced = configuration->reduced.data();
+    std::vector<uint64_t> rawCounts(1 << configuration->nrOfBits, 0);
+
+    uint32_t states[NR_OF_LANES];
+    BitMatrix chunkJump = configuration->laneJump.power(chunkNr * NR_OF_LANES);
+    states[0] = chunkJump.apply(SEED_OFFSET + (uint32_t)configuration->seed);
+    for (int lane = 1; lane < NR_OF_LANES; lane++) {
+        states[lane] = configuration->laneJump.apply(states[lane - 1]);
+    }
+    SlicedLfsr lfsr;
+    lfsr.load(states);
+
+    uint16_t history[NR_OF_LAGS + 1][NR_OF_LANES];
+    bool wasLow[NR_OF_LANES] = { false };
+    uint64_t nrOfLow = 0;
+    uint64_t nrOfChanges = 0;
+    uint64_t sum = 0;
+    uint64_t sumOfSquares = 0;
+    uint64_t lagSums[NR_OF_LAGS] = { 0 };
+    uint16_t values[NR_OF_LANES];
+    for (uint64_t drawNr = 0; drawNr < configuration->drawsPerLane; drawNr++) {
+        lfsr.draw(configuration->nrOfBits, values);
+        uint16_t *current = history[drawNr % (NR_OF_LAGS + 1)];
+        for (int lane = 0; lane < NR_OF_LANES; lane++) {
+            rawCounts[values[lane]]++;
+            uint16_t value = reduced[values[lane]];
+            bool low = value < half;
+            nrOfLow += low;
+            nrOfChanges += (drawNr > 0) && (low != wasLow[lane]);
+            wasLow[lane] = low;
+            sum += value;
+            sumOfSquares += (uint32_t)value * value;
+            current[lane] = value;
+        }
+        for (int lag = 1; (lag <= NR_OF_LAGS) && ((uint64_t)lag <= drawNr); lag++) {
+            const uint16_t *previous = history[(drawNr - lag) % (NR_OF_LAGS + 1)];
+            uint64_t lagSum = 0;
+            for (int lane = 0; lane < NR_OF_LANES; lane++) {
+                lagSum += (uint32_t)current[lane] * previous[lane];
+            }
+            lagSums[lag - 1] += lagSum;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    std::lock_guard<std::mutex> lock(configuration->mutex);
+    for (size_t value = 0; value < rawCounts.size(); value++) {
+        configuration->rawCounts[value] += rawCounts[value];
+    }
+    configuration->nrOfDraws += configuration->drawsPerLane * NR_OF_LANES;
+    configuration->nrOfSegments += NR_OF_LANES;
+    configuration->nrOfLow += nrOfLow;
+    configuration->nrOfChanges += nrOfChanges;
+    configuration->sum += sum;
+    configuration->sumOfSquares += sumOfSquares;
+    for (int lag = 0; lag < NR_OF_LAGS; lag++) {
+        configuration->lagSums[lag] += lagSums[lag];
+        if (configuration->drawsPerLane > (uint64_t)lag + 1) {
+            configuration->lagPairs[lag] += (configuration->drawsPerLane - lag - 1) * NR_OF_LANES;
+        }
+    }
+    configuration->seconds += seconds;
+}
+
+// Upper tail probability of a chi-square value, Wilson-Hilferty approximation.
+double chiSquareP(double chi2, int degreesOfFreedom) {
+    if (degreesOfFreedom <= 0) {
+        return(1.0);
+    }
+    double k = degreesOfFreedom;
+    double z = (pow(chi2 / k, 1.0 / 3.0) - (1.0 - 2.0 / (9.0 * k))) / sqrt(2.0 / (9.0 * k));
+    return(0.5 * erfc(z / sqrt(2.0)));
+}
+
+// Check the matrix, the jump ahead and the bit-sliced draws against LFSR_RandomNumberGenerator.
+bool selfTest(const BitMatrix &step) {
+    bool ok = true;
+    uint32_t state = 0xDEADBEEF;
+    for (int stepNr = 0; stepNr < 1000; stepNr++) {
+        ok &= (step.apply(state) == stepState(state));
+        state = stepState(state);
+    }
+
+    // Jump 12345 steps ahead, then compare 7 bit draws of every lane with the class.
+    const uint64_t jump = 12345;
+    const long seed = 321;
+    LFSR_RandomNumberGenerator generators[NR_OF_LANES];
+    uint32_t states[NR_OF_LANES];
+    BitMatrix laneJump = step.power(jump);
+    states[0] = SEED_OFFSET + seed;
+    for (int lane = 0; lane < NR_OF_LANES; lane++) {
+        if (lane > 0) {
+            states[lane] = laneJump.apply(states[lane - 1]);
+        }
+        generators[lane] = LFSR_RandomNumberGenerator(seed);
+        for (uint64_t stepNr = 0; stepNr < jump * lane; stepNr++) {
+            generators[lane].getRandomNumber(0, 2, 1); // One step.
+        }
+    }
+    SlicedLfsr lfsr;
+    lfsr.load(states);
+    uint16_t values[NR_OF_LANES];
+    for (int nrOfBits = 1; nrOfBits <= MAX_NR_OF_BITS; nrOfBits++) {
+        lfsr.draw(nrOfBits, values);
+        for (int lane = 0; lane < NR_OF_LANES; lane++) {
+            ok &= (values[lane] == generators[lane].getRandomNumber(0, 1 << nrOfBits, nrOfBits));
+        }
+    }
+    return(ok);
+}
+
+// The LFSR has period 2^32 - 1 when M^(2^32 - 1) = I and M^((2^32 - 1) / p) != I for every prime factor p.
+bool isMaximal(const BitMatrix &step) {
+    const uint64_t primeFactors[] = { 3, 5, 17, 257, 65537 };
+    if (!step.power(LFSR_PERIOD).isIdentity()) {
+        return(false);
+    }
+    for (uint64_t primeFactor : primeFactors) {
+        if (step.power(LFSR_PERIOD / primeFactor).isIdentity()) {
+            return(false);
+        }
+    }
+    return(true);
+}
+
+void report(Configuration *configuration, bool verbose) {
+    const int limit = configuration->limit;
+    const int nrOfRawValues = 1 << configuration->nrOfBits;
+    const double draws = configuration->nrOfDraws;
+    std::vector<uint64_t> counts(limit, 0);
+    double rawChi2 = 0.0;
+    double rawExpected = draws / nrOfRawValues;
+    for (int raw = 0; raw < nrOfRawValues; raw++) {
+        counts[configuration->reduced[raw]] += configuration->rawCounts[raw];
+        rawChi2 += (configuration->rawCounts[raw] - rawExpected) * (configuration->rawCounts[raw] - rawExpected) / rawExpected;
+    }
+    double chi2 = 0.0;
+    double expected = draws / limit;
+    int minValue = 0;
+    int maxValue = 0;
+    for (int value = 0; value < limit; value++) {
+        chi2 += (counts[value] - expected) * (counts[value] - expected) / expected;
+        minValue = (counts[value] < counts[minValue]) ? value : minValue;
+        maxValue = (counts[value] > counts[maxValue]) ? value : maxValue;
+    }
+
+    // Runs below / above half of the range, asymptotic Wald-Wolfowitz test over all segments.
+    double lowFraction = configuration->nrOfLow / draws;
+    double pairs = draws - configuration->nrOfSegments;
+    double expectedChanges = 2.0 * lowFraction * (1.0 - lowFraction) * pairs;
+    double changesVariance = 4.0 * pow(lowFraction * (1.0 - lowFraction), 2) * pairs;
+    double runsZ = (changesVariance > 0) ? (configuration->nrOfChanges - expectedChanges) / sqrt(changesVariance) : 0.0;
+
+    double mean = configuration->sum / draws;
+    double variance = configuration->sumOfSquares / draws - mean * mean;
+    double worstSerialZ = 0.0;
+    int worstLag = 0;
+    for (int lag = 0; lag < NR_OF_LAGS; lag++) {
+        if ((configuration->lagPairs[lag] == 0) || (variance <= 0)) {
+            continue;
+        }
+        double correlation = (configuration->lagSums[lag] / configuration->lagPairs[lag] - mean * mean) / variance;
+        double z = correlation * sqrt((double)configuration->lagPairs[lag]);
+        if (fabs(z) > fabs(worstSerialZ)) {
+            worstSerialZ = z;
+            worstLag = lag + 1;
+        }
+    }
+
+    printf("seed %5ld %2d bits %% %3d: %.3g draws (%.2f periods) %6.0f M/s | raw chi2 p %.3f | chi2 %.3g p %.3g"
+        " | runs z %6.2f | serial z %6.2f (lag %d) | P(value) %.4f%% ... %.4f%% (ideal %.4f%%)\n",
+        configuration->seed, configuration->nrOfBits, limit, draws,
+        draws * configuration->nrOfBits / LFSR_PERIOD, draws / configuration->seconds / 1e6,
+        chiSquareP(rawChi2, nrOfRawValues - 1), chi2, chiSquareP(chi2, limit - 1), runsZ, worstSerialZ, worstLag,
+        100.0 * counts[minValue] / draws, 100.0 * counts[maxValue] / draws, 100.0 / limit);
+
+    if (limit <= 16) {
+        printf("    P(value):");
+        for (int value = 0; value < limit; value++) {
+            printf(" %d: %.3f%%", value, 100.0 * counts[value] / draws);
+        }
+        printf("\n");
+    }
+    if (limit == 100) {
+        // The chance knob: a ratchet happens when the drawn value is below the chance level.
+        printf("    chance knob -> effective chance:");
+        uint64_t below = 0;
+        for (int level = 0; level <= 100; level++) {
+            if ((level % 10 == 0) && (level > 0)) {
+                printf(" %d%%: %.2f%%", level, 100.0 * below / draws);
+            }
+            if (level < 100) {
+                below += counts[level];
+            }
+        }
+        printf("\n");
+    }
+    if (verbose && (limit > 16)) {
+        for (int value = 0; value < limit; value++) {
+            printf("%s%3d: %.4f%%", (value % 10 == 0) ? "    " : "  ", value, 100.0 * counts[value] / draws);
+            if ((value % 10 == 9) || (value == limit - 1)) {
+                printf("\n");
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t drawsPerConfiguration = 0;
+    size_t nrOfThreads = std::thread::hardware_concurrency();
+    std::vector<long> seeds = { 0, 300, 512, 1023 }; // The firmware seeds with analogRead() of a floating input.
+    bool verbose = false;
+    for (int argCnt = 1; argCnt < argc; argCnt++) {
+        if ((strcmp(argv[argCnt], "-d") == 0) && (argCnt + 1 < argc)) {
+            drawsPerConfiguration = (uint64_t)atof(argv[++argCnt]);
+        } else if ((strcmp(argv[argCnt], "-t") == 0) && (argCnt + 1 < argc)) {
+            nrOfThreads = atoi(argv[++argCnt]);
+        } else if ((strcmp(argv[argCnt], "-s") == 0) && (argCnt + 1 < argc)) {
+            seeds.clear();
+            for (char *seed = strtok(argv[++argCnt], ","); seed != nullptr; seed = strtok(nullptr, ",")) {
+                seeds.push_back(atol(seed));
+            }
+        } else if (strcmp(argv[argCnt], "-v") == 0) {
+            verbose = true;
+        } else {
+            fprintf(stderr, "usage: %s [-d draws, 0 = one period] [-t threads] [-s seed,seed,...] [-v]\n", argv[0]);
+            return(1);
+        }
+    }
+
+    BitMatrix step = BitMatrix::step();
+    if (!selfTest(step)) {
+        fprintf(stderr, "self test failed: the GF(2) model does not match LFSR_RandomNumberGenerator\n");
+        return(1);
+    }
+    printf("self test passed, LFSR period is %s\n\n", isMaximal(step) ? "2^32 - 1 (maximal)" : "NOT maximal");
+
+    // Chance (SEVEN_BITS, 0 ... 99) and alternatives, then the MAX_MULT ranges (FOUR_BITS, up to 6 values).
+    const int setups[][2] = { { 7, 100 }, { 8, 100 }, { 10, 100 }, { 16, 100 }, { 4, 2 }, { 4, 3 }, { 4, 5 }, { 4, 6 } };
+    std::vector<Configuration *> configurations;
+    for (const auto &setup : setups) {
+        for (long seed : seeds) {
+            Configuration *configuration = new Configuration();
+            configuration->seed = seed;
+            configuration->nrOfBits = setup[0];
+            configuration->limit = setup[1];
+            uint64_t draws = drawsPerConfiguration ? drawsPerConfiguration : LFSR_PERIOD / setup[0];
+            configuration->drawsPerLane = std::max<uint64_t>(draws / (CHUNKS_PER_CONFIGURATION * NR_OF_LANES), 1);
+            configuration->laneJump = step.power(configuration->drawsPerLane * setup[0]);
+            configuration->rawCounts.assign(1 << setup[0], 0);
+            for (int raw = 0; raw < (1 << setup[0]); raw++) {
+                configuration->reduced.push_back(raw % setup[1]);
+            }
+            configurations.push_back(configuration);
+        }
+    }
+
+    WorkStealingPool pool(nrOfThreads);
+    auto startTime = std::chrono::steady_clock::now();
+    pool.run(configurations.size() * CHUNKS_PER_CONFIGURATION, [&](size_t jobNr, size_t) {
+        runChunk(configurations[jobNr / CHUNKS_PER_CONFIGURATION], jobNr % CHUNKS_PER_CONFIGURATION);
+    });
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    double totalDraws = 0;
+    for (Configuration *configuration : configurations) {
+        report(configuration, verbose);
+        totalDraws += configuration->nrOfDraws;
+        delete configuration;
+    }
+    printf("\n%.3g draws in %.1f s on %zu threads (%.0f M draws/s), %zu steals\n",
+        totalDraws, elapsed, pool.getNrOfWorkers(), totalDraws / elapsed / 1e6, (size_t)pool.nrOfSteals);
+    return(0);
+}
@@ -0,0 +1,138 @@
+/*
+    Runs the multi-channel RatchetEngine on a Linux host with a simulated (optionally swung) clock
+    and reports per channel how many gates were produced and how well the bursts fit their beats.
+
+    Build (from the tools directory):
+        g++ -std=c++11 -O2 -Wall -I../src -o simulate_channels simulate_channels.cpp
+
+    Usage:
+        ./simulate_channels [bpm] [swing percent] [seconds] [-e]
+
+    A swing of 50 percent is a straight clock, 66 percent is triplet swing. With -e every output
+    edge is printed as "time_us,pin,level".
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "HostRatchetHal.hpp"
+#include "RatchetEngine.hpp"
+
+#define NR_OF_SIMULATED_CHANNELS 4
+
+struct ChannelSetup {
+    uint8_t pin;
+    uint8_t mode;
+    uint8_t factor;
+    uint8_t maxFactor;
+    uint8_t chance;
+};
+
+const ChannelSetup channelSetups[NR_OF_SIMULATED_CHANNELS] = {
+    { 5, CHANNEL_MULT, 3, 3, 100 },    // Like CLOCK_OUT: always 3 ratchets.
+    { 10, CHANNEL_MULT, 2, 2, 50 },    // 2 ratchets on half of the beats.
+    { 11, CHANNEL_DIV, 2, 2, 100 },    // Every other beat.
+    { 12, CHANNEL_MAX_MULT, 1, 4, 100 } // 1 ... 4 ratchets.
+};
+
+struct PinStats {
+    unsigned long risingEdges = 0;
+    uint32_t lastFallTime = 0;
+    bool high = false;
+    bool fallSeen = false;
+    long minSlack = 0x7FFFFFFF;   // Shortest time between the end of a gate and the next clock edge.
+    unsigned long cutGates = 0;   // Gates still high when the next clock edge arrived.
+};
+
+struct Simulation {
+    PinStats pins[256];
+    bool printEdges = false;
+};
+
+void onEdge(void *context, uint32_t time, uint8_t pinNumber, bool level) {
+    Simulation *simulation = (Simulation *)context;
+    PinStats *pin = &simulation->pins[pinNumber];
+    if (level && !pin->high) {
+        pin->risingEdges++;
+    }
+    if (!level && pin->high) {
+        pin->lastFallTime = time;
+        pin->fallSeen = true;
+    }
+    pin->high = level;
+    if (simulation->printEdges) {
+        printf("%u,%u,%d\n", time, pinNumber, level ? 1 : 0);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    double bpm = 120.0;
+    double swing = 50.0;
+    double seconds = 60.0;
+    Simulation simulation;
+    int argNr = 0;
+    for (int argCnt = 1; argCnt < argc; argCnt++) {
+        if (strcmp(argv[argCnt], "-e") == 0) {
+            simulation.printEdges = true;
+        } else if (argNr == 0) {
+            bpm = atof(argv[argCnt]);
+            argNr++;
+        } else if (argNr == 1) {
+            swing = atof(argv[argCnt]);
+            argNr++;
+        } else {
+            seconds = atof(argv[argCnt]);
+        }
+    }
+
+    HostRatchetHal hal;
+    hal.setEdgeCallback(onEdge, &simulation);
+    LFSR_RandomNumberGenerator randomNumberGenerator(1234);
+    RatchetEngine<HostRatchetHal> engine(&hal, &randomNumberGenerator);
+    for (int channelCnt = 0; channelCnt < NR_OF_SIMULATED_CHANNELS; channelCnt++) {
+        const ChannelSetup *setup = &channelSetups[channelCnt];
+        uint8_t channelNr = engine.addChannel(setup->pin, setup->mode, setup->factor, setup->chance);
+        engine.getChannel(channelNr)->maxFactor = setup->maxFactor;
+    }
+
+    // Two clock pulses per beat (8th notes), alternately long and short when swung.
+    double pairTime = 60e6 / bpm;
+    uint32_t longTime = pairTime * swing / 100.0;
+    uint32_t shortTime = pairTime - longTime;
+    uint32_t time = 1000;
+    unsigned long nrOfClocks = 0;
+    while (time < seconds * 1e6) {
+        hal.runUntil(&engine, time);
+        for (int channelCnt = 0; channelCnt < NR_OF_SIMULATED_CHANNELS; channelCnt++) {
+            const ChannelSetup *setup = &channelSetups[channelCnt];
+            PinStats *pin = &simulation.pins[setup->pin];
+            // A DIV gate of a division above 1 lasts until the next clock edge by design.
+            bool gateHeld = (setup->mode == CHANNEL_DIV) && (setup->factor > 1);
+            if (pin->high) {
+                if (!gateHeld) {
+                    pin->cutGates++;
+                }
+            } else if (pin->fallSeen && (nrOfClocks > 8)) { // Give the tempo tracker some time.
+                long slack = time - pin->lastFallTime;
+                if (slack < pin->minSlack) {
+                    pin->minSlack = slack;
+                }
+            }
+            pin->fallSeen = false;
+        }
+        engine.stopBursts();
+        engine.clockEdge(time);
+        time += (nrOfClocks++ % 2) ? shortTime : longTime;
+    }
+
+    fprintf(stderr, "%lu clock pulses at %.1f bpm, swing %.0f%%, detected pattern length %u\n",
+        nrOfClocks, bpm, swing, engine.getTempo()->getPatternLength());
+    for (int channelCnt = 0; channelCnt < NR_OF_SIMULATED_CHANNELS; channelCnt++) {
+        const ChannelSetup *setup = &channelSetups[channelCnt];
+        PinStats *pin = &simulation.pins[setup->pin];
+        fprintf(stderr, "pin %2u mode %u factor %u..%u chance %3u%%: %7lu gates, %5lu cut off by the next clock, min slack %ld uS\n",
+            setup->pin, setup->mode, setup->factor, setup->maxFactor, setup->chance,
+            pin->risingEdges, pin->cutGates, (pin->minSlack == 0x7FFFFFFF) ? 0 : pin->minSlack);
+    }
+    return(0);
+}
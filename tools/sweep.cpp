@@ -0,0 +1,533 @@
+/*
+    Parameter sweep for the firmware. Runs thousands of virtual modules, each with its own parameter
+    set and input clock, and reports aggregate timing error and distribution statistics per parameter
+    set, so the tunables of the firmware can be chosen by measurement instead of by trial and error.
+
+    Every virtual module is the firmware itself (src/main.cpp with the options as defined there:
+    clockISR(), the bottom half, timerInterrupt(), getFraction(), the random number generator and
+    the main loop) on the emulated ATmega328P of FirmwareHost.hpp. The firmware keeps its state in
+    globals, so every module runs in a child process of its own.
+
+    Build (from the tools directory):
+        g++ -std=c++11 -O2 -Wall -pthread -Ifirmware_host -o sweep sweep.cpp
+
+    Usage:
+        ./sweep [-s seconds per module] [-t parallel modules] [-n best parameter sets to show] [-c csv file]
+
+    Two kinds of module are run for every parameter set and input clock:
+    - MULT:     the factor follows a slowly moving, noisy CV on FREQ_IN (FREQ_POT at 0) and the chance
+                CV is at 30%,
+    - MAX_MULT: FREQ_POT selects the second and FREQ_IN the fifth entry of the pot table, so every beat
+                draws a count between those two.
+
+    Swept parameters, the firmware defines of the same name:
+    - cycles: NR_OF_CYCLES, the number of clock intervals averaged into the cycle time,
+    - scan:   POTMETER_SCAN_INTERVAL_TIME in mS,
+    - cbits:  SEVEN_BITS, the random bits for the chance draw,
+    - nbits:  FOUR_BITS, the random bits for the MAX_MULT count draw,
+    - table:  the contents of potValues4Mult.
+
+    Reported per parameter set, over all input clocks:
+    - edge error: mean, 99th percentile bucket and max of |actual - ideal| time of the edges of CLOCK_OUT
+                  in MULT, where the ideal edges divide the actual clock interval evenly and the first one
+                  is the clock edge itself (so the lag of the bottom half is included),
+    - cut:        the percentage of ideal edges which did not happen (within half a ratchet period),
+    - stale:      the percentage of MULT beats whose factor did not match the noise free CV,
+    - chance:     the measured ratchet rate in MULT (should be 30%),
+    - chi2:       chi-square of the MAX_MULT counts against a uniform distribution over the range of the
+                  table, divided by its degrees of freedom (values well above 1 are suspicious).
+
+    With SWING_TRACKING defined (the default) the length of a beat comes from the swing tracker, so
+    NR_OF_CYCLES only matters until it has started; and the bottom half reads the pots at every clock
+    edge, so POTMETER_SCAN_INTERVAL_TIME only changes how often the main loop draws from the random
+    number generator. Expect both to make little difference; the sweep is there to show it.
+*/
+
+// The swept defines, set per module before setup() runs.
+unsigned int sweepNrOfCycles = 5;
+unsigned int sweepScanInterval = 100;
+unsigned int sweepChanceBits = 7;
+unsigned int sweepCountBits = 4;
+#define NR_OF_CYCLES sweepNrOfCycles
+#define POTMETER_SCAN_INTERVAL_TIME sweepScanInterval
+#define SEVEN_BITS sweepChanceBits
+#define FOUR_BITS sweepCountBits
+
+#include "FirmwareHost.hpp"
+#include "../src/main.cpp"
+#undef printf
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "WorkStealingPool.hpp"
+
+#define NR_OF_ERROR_BUCKETS 64  // Edge errors are counted in buckets of 2^n uS.
+#define TARGET_CHANCE 30        // Percent.
+#define CHANCE_CV_VALUE 307     // Gives TARGET_CHANCE in getChanceValue().
+#define CLOCK_PULSE_TIME 5000   // uS.
+#define SETTLE_TIME 1000        // uS after a clock edge, by then the bottom half has started the burst.
+#define NR_OF_WARM_UP_BEATS 16  // Give the tempo and swing trackers some time (use -s 20 or more).
+#define MAX_COUNT 8
+
+struct PotTable {
+    const char *name;
+    byte values[NR_OF_MULT_POT_VALUES];
+};
+
+// Tables for potValues4Mult, the firmware's own one first. The firmware has NR_OF_MULT_POT_VALUES
+// entries, so every table has that many.
+const PotTable potTables[] = {
+    { "0-5", { 0, 1, 2, 3, 4, 5 } },
+    { "1-5", { 1, 1, 2, 3, 4, 5 } },
+    { "0-4", { 0, 1, 2, 2, 3, 4 } }
+};
+const int nrOfPotTables = sizeof(potTables) / sizeof(potTables[0]);
+
+const uint8_t cycleCounts[] = { 2, 3, 5, 8 };
+const uint16_t scanIntervals[] = { 10, 50, 100, 200 };
+const uint8_t chanceBits[] = { 7, 8, 10 };
+const uint8_t countBits[] = { 4, 8 };
+
+struct Parameters {
+    uint8_t nrOfCycles;
+    uint16_t scanInterval;
+    uint8_t chanceBits;
+    uint8_t countBits;
+    uint8_t potTable;
+};
+
+struct ClockSetup {
+    const char *name;
+    double bpm;        // Clock pulses per minute at the start.
+    double endBpm;     // Clock pulses per minute at the end, for a tempo ramp.
+    double swing;      // Percentage of a pair of pulses taken by the first one.
+    double jitter;     // Standard deviation of the clock edges in uS.
+};
+
+const ClockSetup clockSetups[] = {
+    { "steady 120", 240, 240, 50, 0 },
+    { "swing 66%", 200, 200, 66, 200 },
+    { "jitter 2%", 280, 280, 50, 4000 },
+    { "ramp 90-150", 180, 300, 50, 500 }
+};
+const int nrOfClockSetups = sizeof(clockSetups) / sizeof(clockSetups[0]);
+
+enum ModuleKind { MODULE_MULT, MODULE_MAX_MULT, NR_OF_MODULE_KINDS };
+
+// Plain data, so a child process can hand it to the parent through shared memory.
+struct Statistics {
+    unsigned long long edgeErrorSum = 0;
+    unsigned long long nrOfEdges = 0;
+    unsigned long long nrOfCutEdges = 0;
+    unsigned long maxEdgeError = 0;
+    unsigned long long errorBuckets[NR_OF_ERROR_BUCKETS] = { 0 };
+    unsigned long long nrOfBeats = 0;
+    unsigned long long nrOfStaleBeats = 0;
+    unsigned long long nrOfChanceBeats = 0;
+    unsigned long long nrOfRatchetBeats = 0;
+    unsigned long long countHistogram[MAX_COUNT + 1] = { 0 };
+    uint8_t minCount = MAX_COUNT;
+    uint8_t maxCount = 0;
+    bool valid = false;
+
+    void add(const Statistics &other) {
+        edgeErrorSum += other.edgeErrorSum;
+        nrOfEdges += other.nrOfEdges;
+        nrOfCutEdges += other.nrOfCutEdges;
+        maxEdgeError = std::max(maxEdgeError, other.maxEdgeError);
+        for (int bucket = 0; bucket < NR_OF_ERROR_BUCKETS; bucket++) {
+            errorBuckets[bucket] += other.errorBuckets[bucket];
+        }
+        nrOfBeats += other.nrOfBeats;
+        nrOfStaleBeats += other.nrOfStaleBeats;
+        nrOfChanceBeats += other.nrOfChanceBeats;
+        nrOfRatchetBeats += other.nrOfRatchetBeats;
+        for (int count = 0; count <= MAX_COUNT; count++) {
+            countHistogram[count] += other.countHistogram[count];
+        }
+        minCount = std::min(minCount, other.minCount);
+        maxCount = std::max(maxCount, other.maxCount);
+        valid = valid || other.valid;
+    }
+
+    void addEdgeError(unsigned long error) {
+        edgeErrorSum += error;
+        nrOfEdges++;
+        maxEdgeError = std::max(maxEdgeError, error);
+        int bucket = 0;
+        while ((error >> bucket) > 1) {
+            bucket++;
+        }
+        errorBuckets[bucket]++;
+    }
+
+    double meanEdgeError() const {
+        return(nrOfEdges ? (double)edgeErrorSum / nrOfEdges : 0.0);
+    }
+
+    // The upper limit of the bucket which holds the 99th percentile.
+    unsigned long percentile99() const {
+        unsigned long long seen = 0;
+        for (int bucket = 0; bucket < NR_OF_ERROR_BUCKETS; bucket++) {
+            seen += errorBuckets[bucket];
+            if (seen * 100 >= nrOfEdges * 99) {
+                return(2UL << bucket);
+            }
+        }
+        return(0);
+    }
+
+    double cutPercentage() const {
+        unsigned long long all = nrOfEdges + nrOfCutEdges;
+        return(all ? 100.0 * nrOfCutEdges / all : 0.0);
+    }
+
+    double stalePercentage() const {
+        return(nrOfBeats ? 100.0 * nrOfStaleBeats / nrOfBeats : 0.0);
+    }
+
+    double chancePercentage() const {
+        return(nrOfChanceBeats ? 100.0 * nrOfRatchetBeats / nrOfChanceBeats : 0.0);
+    }
+
+    // Chi-square per degree of freedom of the counts against a uniform distribution over minCount ... maxCount.
+    // Only meaningful for modules with the same pot table.
+    double chiSquare() const {
+        if (maxCount <= minCount) {
+            return(0.0);
+        }
+        unsigned long long total = 0;
+        for (int count = minCount; count <= maxCount; count++) {
+            total += countHistogram[count];
+        }
+        double expected = (double)total / (maxCount - minCount + 1);
+        double chi2 = 0.0;
+        for (int count = minCount; count <= maxCount; count++) {
+            double difference = countHistogram[count] - expected;
+            chi2 += difference * difference / expected;
+        }
+        return(chi2 / (maxCount - minCount));
+    }
+};
+
+struct Edge {
+    uint64_t time; // uS.
+    bool level;
+};
+
+// The analog inputs and the output of one virtual module.
+struct ModuleContext {
+    ModuleKind kind;
+    const PotTable *potTable;
+    std::mt19937 generator;
+    int seedValue;
+    std::vector<Edge> edges;
+};
+
+// The CV which sets the factor in MULT: a slow sine, 0 ... 1023.
+double cvValue(double seconds) {
+    return(512.0 + 500.0 * sin(2.0 * M_PI * seconds / 7.3));
+}
+
+// The middle of the range of pot values which selects entry index of a table.
+int potValueOfIndex(int index) {
+    return((2 * index + 1) * 1024 / (2 * NR_OF_MULT_POT_VALUES));
+}
+
+int analogValue(void *context, uint8_t analogNumber, uint64_t cycle) {
+    ModuleContext *module = (ModuleContext *)context;
+    switch (analogNumber) {
+        case FREQ_IN_MPU - A0:
+            if (module->kind == MODULE_MAX_MULT) {
+                return(potValueOfIndex(4));
+            } else {
+                std::uniform_int_distribution<int> noise(-6, 6);
+                int value = (int)cvValue(cycle / (1e6 * FIRMWARE_HOST_CYCLES_PER_US)) + noise(module->generator);
+                return(std::min(std::max(value, 0), 1023));
+            }
+        case FREQ_POT_MPU - A0:
+            return((module->kind == MODULE_MAX_MULT) ? potValueOfIndex(1) : 0);
+        case CHANCE_IN_MPU - A0:
+            return(CHANCE_CV_VALUE);
+        case A4 - A0: // Seeds the random number generator.
+            return(module->seedValue);
+    }
+    return(0);
+}
+
+void onEdge(void *context, uint64_t cycle, uint8_t pinNumber, bool level) {
+    ModuleContext *module = (ModuleContext *)context;
+    if (pinNumber == CLOCK_OUT) {
+        module->edges.push_back({ cycle / FIRMWARE_HOST_CYCLES_PER_US, level });
+    }
+}
+
+// Compare the edges of the beat from beatStart to beatEnd with pulses evenly spread gates.
+void evaluateBeat(Statistics &statistics, const std::vector<Edge> &edges, uint64_t beatStart, uint64_t beatEnd, int pulses) {
+    double halfPeriod = (double)(beatEnd - beatStart) / (2 * pulses);
+    for (int edgeNr = 0; edgeNr < 2 * pulses; edgeNr++) {
+        double ideal = beatStart + edgeNr * halfPeriod;
+        bool level = (edgeNr % 2) == 0;
+        double bestError = halfPeriod / 2;
+        bool found = false;
+        for (const Edge &edge : edges) {
+            double error = fabs((double)edge.time - ideal);
+            if ((edge.level == level) && (error <= bestError)) {
+                bestError = error;
+                found = true;
+            }
+        }
+        if (found) {
+            statistics.addEdgeError((unsigned long)bestError);
+        } else {
+            statistics.nrOfCutEdges++;
+        }
+    }
+}
+
+// Run one virtual module. Called in a child process: the firmware is used once.
+Statistics simulate(const Parameters &parameters, const ClockSetup &clock, ModuleKind kind, uint32_t seed, double seconds) {
+    Statistics statistics;
+    statistics.valid = true;
+    sweepNrOfCycles = parameters.nrOfCycles;
+    sweepScanInterval = parameters.scanInterval;
+    sweepChanceBits = parameters.chanceBits;
+    sweepCountBits = parameters.countBits;
+    const PotTable &potTable = potTables[parameters.potTable];
+    memcpy(potValues4Mult, potTable.values, sizeof(potValues4Mult));
+
+    ModuleContext module;
+    module.kind = kind;
+    module.potTable = &potTable;
+    module.generator.seed(seed);
+    module.seedValue = seed % 1024;
+    firmwareHost.setAnalogSource(analogValue, &module);
+    firmwareHost.setEdgeCallback(onEdge, &module);
+    firmwareHost.begin();
+    if (kind == MODULE_MAX_MULT) {
+        button.doubleClick();
+    }
+    std::normal_distribution<double> jitter(0.0, clock.jitter > 0 ? clock.jitter : 1.0);
+
+    uint64_t startTime = firmwareHost.nowMicros() + 100000;
+    uint64_t endTime = startTime + (uint64_t)(seconds * 1e6);
+    double idealClockTime = startTime;
+    uint64_t clockTime = startTime;
+    uint64_t lastClockTime = 0;
+    unsigned long nrOfClocks = 0;
+    int beatPulses = 0;
+    while (clockTime < endTime) {
+        firmwareHost.scheduleInput(clockTime * FIRMWARE_HOST_CYCLES_PER_US, EXT_CLOCK_IN, HIGH);
+        firmwareHost.scheduleInput((clockTime + CLOCK_PULSE_TIME) * FIRMWARE_HOST_CYCLES_PER_US, EXT_CLOCK_IN, LOW);
+        firmwareHost.runMicros(clockTime + SETTLE_TIME);
+
+        // The beat which ended at this clock edge, including an early rise of this beat.
+        if ((kind == MODULE_MULT) && (beatPulses > 0) && (nrOfClocks > NR_OF_WARM_UP_BEATS)) {
+            evaluateBeat(statistics, module.edges, lastClockTime, clockTime, beatPulses);
+        }
+        // Keep the edges from half a beat before this clock edge on.
+        uint64_t keepFrom = clockTime - (clockTime - lastClockTime) / 2;
+        module.edges.erase(module.edges.begin(), std::find_if(module.edges.begin(), module.edges.end(),
+            [&](const Edge &edge) { return(edge.time >= keepFrom); }));
+
+        // The beat which started at this clock edge, as the bottom half has set it up.
+        beatPulses = (frac == 0) ? 0 : burstPulses;
+        if (nrOfClocks > NR_OF_WARM_UP_BEATS) {
+            if (kind == MODULE_MULT) {
+                statistics.nrOfBeats++;
+                byte wantedFactor = potTable.values[potValueToIndex((int)cvValue(clockTime / 1e6), NR_OF_MULT_POT_VALUES)];
+                if (frac != wantedFactor) {
+                    statistics.nrOfStaleBeats++;
+                }
+                if (frac > 1) {
+                    statistics.nrOfChanceBeats++;
+                    if (burstPulses > 1) {
+                        statistics.nrOfRatchetBeats++;
+                    }
+                }
+            } else if (burstPulses <= MAX_COUNT) {
+                statistics.countHistogram[burstPulses]++;
+            }
+        }
+
+        // The next clock edge.
+        double progress = (double)(clockTime - startTime) / (endTime - startTime);
+        double bpm = clock.bpm + (clock.endBpm - clock.bpm) * progress;
+        double pairTime = 2 * 60e6 / bpm;
+        idealClockTime += pairTime * (((nrOfClocks % 2) == 0) ? clock.swing : (100 - clock.swing)) / 100.0;
+        double nextTime = idealClockTime + ((clock.jitter > 0) ? jitter(module.generator) : 0.0);
+        lastClockTime = clockTime;
+        clockTime = std::max((uint64_t)nextTime, clockTime + CLOCK_PULSE_TIME + SETTLE_TIME);
+        nrOfClocks++;
+    }
+    if (kind == MODULE_MAX_MULT) {
+        statistics.minCount = potTable.values[1];
+        statistics.maxCount = potTable.values[4];
+    }
+    return(statistics);
+}
+
+int main(int argc, char *argv[]) {
+    double seconds = 30.0;
+    size_t nrOfThreads = std::thread::hardware_concurrency();
+    size_t nrOfBest = 15;
+    const char *csvFileName = nullptr;
+    for (int argCnt = 1; argCnt + 1 < argc; argCnt += 2) {
+        if (strcmp(argv[argCnt], "-s") == 0) {
+            seconds = atof(argv[argCnt + 1]);
+        } else if (strcmp(argv[argCnt], "-t") == 0) {
+            nrOfThreads = atoi(argv[argCnt + 1]);
+        } else if (strcmp(argv[argCnt], "-n") == 0) {
+            nrOfBest = atoi(argv[argCnt + 1]);
+        } else if (strcmp(argv[argCnt], "-c") == 0) {
+            csvFileName = argv[argCnt + 1];
+        } else {
+            fprintf(stderr, "usage: %s [-s seconds] [-t parallel modules] [-n best] [-c csv file]\n", argv[0]);
+            return(1);
+        }
+    }
+
+    std::vector<Parameters> parameterSets;
+    for (uint8_t nrOfCycles : cycleCounts) {
+        for (uint16_t scanInterval : scanIntervals) {
+            for (uint8_t someChanceBits : chanceBits) {
+                for (uint8_t someCountBits : countBits) {
+                    for (int potTable = 0; potTable < nrOfPotTables; potTable++) {
+                        parameterSets.push_back({ nrOfCycles, scanInterval, someChanceBits, someCountBits, (uint8_t)potTable });
+                    }
+                }
+            }
+        }
+    }
+    size_t modulesPerSet = nrOfClockSetups * NR_OF_MODULE_KINDS;
+    size_t nrOfModules = parameterSets.size() * modulesPerSet;
+    // The children write their results here.
+    Statistics *results = (Statistics *)mmap(nullptr, nrOfModules * sizeof(Statistics), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        perror("mmap");
+        return(1);
+    }
+
+    // Every worker thread runs one child process at a time.
+    WorkStealingPool pool(nrOfThreads);
+    auto startTime = std::chrono::steady_clock::now();
+    pool.run(nrOfModules, [&](size_t moduleNr, size_t) {
+        pid_t child = fork();
+        if (child == 0) {
+            const Parameters &parameters = parameterSets[moduleNr / modulesPerSet];
+            const ClockSetup &clock = clockSetups[(moduleNr / NR_OF_MODULE_KINDS) % nrOfClockSetups];
+            ModuleKind kind = (ModuleKind)(moduleNr % NR_OF_MODULE_KINDS);
+            results[moduleNr] = simulate(parameters, clock, kind, 0x5EED0000u + moduleNr, seconds);
+            _exit(0);
+        }
+        if (child > 0) {
+            waitpid(child, nullptr, 0);
+        }
+    });
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    std::vector<Statistics> perSet(parameterSets.size());
+    size_t nrOfFailures = 0;
+    for (size_t moduleNr = 0; moduleNr < nrOfModules; moduleNr++) {
+        if (!results[moduleNr].valid) {
+            nrOfFailures++;
+        }
+        perSet[moduleNr / modulesPerSet].add(results[moduleNr]);
+    }
+    printf("%zu virtual modules of %.0f s each (%.1f hours of module time) in %.2f s on %zu threads, %zu steals\n",
+        nrOfModules, seconds, nrOfModules * seconds / 3600.0, elapsed, pool.getNrOfWorkers(), (size_t)pool.nrOfSteals);
+    if (nrOfFailures > 0) {
+        printf("%zu modules did not finish!\n", nrOfFailures);
+    }
+    printf("\n");
+
+    std::vector<size_t> order(parameterSets.size());
+    for (size_t setNr = 0; setNr < order.size(); setNr++) {
+        order[setNr] = setNr;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t one, size_t other) {
+        double oneScore = perSet[one].meanEdgeError() + perSet[one].cutPercentage() * 1000.0;
+        double otherScore = perSet[other].meanEdgeError() + perSet[other].cutPercentage() * 1000.0;
+        return(oneScore < otherScore);
+    });
+    printf("cycles scan cbits nbits table | error uS: mean    p99    max |  cut%%  stale%% chance%%  chi2\n");
+    for (size_t rank = 0; (rank < nrOfBest) && (rank < order.size()); rank++) {
+        const Parameters &parameters = parameterSets[order[rank]];
+        const Statistics &statistics = perSet[order[rank]];
+        printf("%6u %4u %5u %5u %5s | %14.0f %6lu %6lu | %5.2f %6.2f %7.2f %5.2f\n",
+            parameters.nrOfCycles, parameters.scanInterval, parameters.chanceBits, parameters.countBits,
+            potTables[parameters.potTable].name, statistics.meanEdgeError(), statistics.percentile99(),
+            statistics.maxEdgeError, statistics.cutPercentage(), statistics.stalePercentage(),
+            statistics.chancePercentage(), statistics.chiSquare());
+    }
+
+    // The effect of every parameter on its own, averaged over all others.
+    printf("\nper parameter value (over all other parameters):\n");
+    struct Marginal {
+        const char *name;
+        std::string value;
+        Statistics statistics;
+        double chi2Sum;  // The pot tables differ in range, so chi2 is averaged over the parameter sets.
+        int nrOfSets;
+    };
+    std::vector<Marginal> marginals;
+    auto addMarginal = [&](const char *name, const std::string &value, const Statistics &statistics) {
+        for (Marginal &marginal : marginals) {
+            if ((strcmp(marginal.name, name) == 0) && (marginal.value == value)) {
+                marginal.statistics.add(statistics);
+                marginal.chi2Sum += statistics.chiSquare();
+                marginal.nrOfSets++;
+                return;
+            }
+        }
+        marginals.push_back({ name, value, statistics, statistics.chiSquare(), 1 });
+    };
+    const char *names[] = { "cycles", "scan", "cbits", "nbits", "table" };
+    for (size_t setNr = 0; setNr < parameterSets.size(); setNr++) {
+        const Parameters &parameters = parameterSets[setNr];
+        addMarginal("cycles", std::to_string(parameters.nrOfCycles), perSet[setNr]);
+        addMarginal("scan", std::to_string(parameters.scanInterval), perSet[setNr]);
+        addMarginal("cbits", std::to_string(parameters.chanceBits), perSet[setNr]);
+        addMarginal("nbits", std::to_string(parameters.countBits), perSet[setNr]);
+        addMarginal("table", potTables[parameters.potTable].name, perSet[setNr]);
+    }
+    std::stable_sort(marginals.begin(), marginals.end(), [&](const Marginal &one, const Marginal &other) {
+        return(std::find_if(names, names + 5, [&](const char *name) { return(strcmp(name, one.name) == 0); })
+            < std::find_if(names, names + 5, [&](const char *name) { return(strcmp(name, other.name) == 0); }));
+    });
+    for (const Marginal &marginal : marginals) {
+        printf("  %-6s %4s: edge error mean %6.0f uS  cut %5.2f%%  stale %5.2f%%  chance %6.2f%%  chi2 %6.2f\n",
+            marginal.name, marginal.value.c_str(), marginal.statistics.meanEdgeError(), marginal.statistics.cutPercentage(),
+            marginal.statistics.stalePercentage(), marginal.statistics.chancePercentage(), marginal.chi2Sum / marginal.nrOfSets);
+    }
+
+    if (csvFileName != nullptr) {
+        FILE *csvFile = fopen(csvFileName, "w");
+        if (csvFile == nullptr) {
+            perror(csvFileName);
+            return(1);
+        }
+        fprintf(csvFile, "cycles,scan,cbits,nbits,table,mean_error_us,p99_error_us,max_error_us,cut_pct,stale_pct,chance_pct,chi2\n");
+        for (size_t setNr = 0; setNr < parameterSets.size(); setNr++) {
+            const Parameters &parameters = parameterSets[setNr];
+            const Statistics &statistics = perSet[setNr];
+            fprintf(csvFile, "%u,%u,%u,%u,%s,%.1f,%lu,%lu,%.3f,%.3f,%.3f,%.2f\n",
+                parameters.nrOfCycles, parameters.scanInterval, parameters.chanceBits, parameters.countBits,
+                potTables[parameters.potTable].name, statistics.meanEdgeError(), statistics.percentile99(),
+                statistics.maxEdgeError, statistics.cutPercentage(), statistics.stalePercentage(),
+                statistics.chancePercentage(), statistics.chiSquare());
+        }
+        fclose(csvFile);
+    }
+    return(0);
+}
@@ -0,0 +1,85 @@
+/*
+    Checks the DIV mode of the multi-channel RatchetEngine on a Linux host: with a steady clock,
+    DIV n must produce one gate every n beats. As in the single channel firmware, a gate of DIV 1
+    must last half a beat and a gate of a higher division a whole beat, i.e. until the next clock edge.
+
+    Build and run (from the tools directory):
+        g++ -std=c++11 -O2 -Wall -I../src -o test_div test_div.cpp && ./test_div
+
+    Prints one line per division and exits with 1 if any check failed.
+*/
+
+#include <cstdio>
+#include "HostRatchetHal.hpp"
+#include "RatchetEngine.hpp"
+
+#define TEST_PIN 5
+#define TEST_BEAT_TIME 500000UL // 120 bpm.
+#define TEST_NR_OF_BEATS 24
+#define TEST_TOLERANCE 2        // uS, for the rounding of the half period.
+
+struct GateStats {
+    unsigned long gateTime = 0;   // The expected length of a gate.
+    uint32_t endTime = 0;         // Gates which start at or after this time are not counted.
+    unsigned long gates = 0;
+    unsigned long wrongGates = 0; // Gates which did not last gateTime.
+    uint32_t riseTime = 0;
+    bool high = false;
+};
+
+void onEdge(void *context, uint32_t time, uint8_t, bool level) {
+    GateStats *stats = (GateStats *)context;
+    if (level && (time >= stats->endTime)) {
+        return;
+    }
+    if (level && !stats->high) {
+        stats->gates++;
+        stats->riseTime = time;
+    }
+    if (!level && stats->high) {
+        long length = time - stats->riseTime;
+        long error = length - (long) stats->gateTime;
+        if ((error > TEST_TOLERANCE) || (error < -TEST_TOLERANCE)) {
+            stats->wrongGates++;
+        }
+    }
+    stats->high = level;
+}
+
+// Run DIV division over TEST_NR_OF_BEATS beats and return true when all checks pass.
+bool testDivision(uint8_t division) {
+    GateStats stats;
+    stats.gateTime = (division == 1) ? TEST_BEAT_TIME / 2 : TEST_BEAT_TIME;
+    // The clock edge after the last beat ends its gate.
+    stats.endTime = 1000 + (TEST_NR_OF_BEATS + 1) * TEST_BEAT_TIME;
+    HostRatchetHal hal;
+    hal.setEdgeCallback(onEdge, &stats);
+    LFSR_RandomNumberGenerator randomNumberGenerator(1234);
+    RatchetEngine<HostRatchetHal> engine(&hal, &randomNumberGenerator);
+    engine.addChannel(TEST_PIN, CHANNEL_DIV, division, 100);
+
+    // The first clock edge only starts the tempo tracker, the first beat starts with the second one.
+    uint32_t time = 1000;
+    for (int clockCnt = 0; clockCnt <= TEST_NR_OF_BEATS + 1; clockCnt++) {
+        hal.runUntil(&engine, time);
+        engine.stopBursts();
+        engine.clockEdge(time);
+        time += TEST_BEAT_TIME;
+    }
+    hal.runUntil(&engine, time);
+
+    unsigned long expectedGates = TEST_NR_OF_BEATS / division;
+    bool passed = (stats.gates == expectedGates) && (stats.wrongGates == 0) && !stats.high;
+    printf("DIV %u: %lu gates (expected %lu), %lu not %lu uS long, output %s at the end: %s\n",
+        division, stats.gates, expectedGates, stats.wrongGates, stats.gateTime, stats.high ? "high" : "low",
+        passed ? "ok" : "FAILED");
+    return(passed);
+}
+
+int main() {
+    bool passed = true;
+    for (uint8_t division = 1; division <= 3; division++) {
+        passed = testDivision(division) && passed;
+    }
+    return(passed ? 0 : 1);
+}
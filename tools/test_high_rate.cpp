@@ -0,0 +1,88 @@
+/*
+    Checks the high rate mode of the firmware on the emulated ATmega328P of FirmwareHost.hpp: a clock
+    which starts at once at 500 Hz ... 50 kHz must bring the module into the high rate mode, where MULT 3
+    must give exactly 3 output pulses and DIV 2 exactly 1 output pulse for every 2 clock pulses.
+
+    The emulator runs interrupt routines in zero time, so this shows up to which frequency the design
+    works, not the maximum frequency of a module: that is set by the run time of the interrupt routines
+    (see "Maximum input frequencies" in manual.txt).
+
+    Build and run (from the tools directory):
+        g++ -std=c++11 -O2 -Wall -Ifirmware_host -o test_high_rate test_high_rate.cpp && ./test_high_rate
+
+    Prints one line per mode and frequency and exits with 1 if any check failed.
+*/
+
+#include "FirmwareHost.hpp"
+#include "../src/main.cpp"
+#undef printf
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TEST_START_TIME    2000000ULL // uS, after setup() and the first pot scans.
+#define TEST_SETTLE_TIME   2000000ULL // uS, for the tempo to be measured and the mode to switch.
+#define TEST_COUNT_TIME    1000000ULL // uS
+#define TEST_MULT_3_POT    600        // Selects the fourth entry of potValues4Mult, i.e. a factor of 3.
+#define TEST_DIV_2_POT     233        // Selects the third entry of potValues4Div, i.e. a division of 2.
+
+const unsigned long testFrequencies[] = { 500, 2000, 3000, 10000, 20000, 50000 }; // Hz
+
+static uint64_t countFrom;
+static unsigned long outputPulses = 0;
+
+static void onEdge(void *, uint64_t cycle, uint8_t pinNumber, bool level) {
+    if ((pinNumber == CLOCK_OUT) && level && (cycle >= countFrom)) {
+        outputPulses++;
+    }
+}
+
+static bool testFrequency(bool div, unsigned long frequency) {
+    uint64_t period = F_CPU / frequency;
+    uint64_t start = TEST_START_TIME * FIRMWARE_HOST_CYCLES_PER_US;
+    uint64_t end = (TEST_START_TIME + TEST_SETTLE_TIME + TEST_COUNT_TIME) * FIRMWARE_HOST_CYCLES_PER_US;
+    countFrom = (TEST_START_TIME + TEST_SETTLE_TIME) * FIRMWARE_HOST_CYCLES_PER_US;
+    unsigned long clockPulses = 0;
+    for (uint64_t cycle = start; cycle < end; cycle += period) {
+        firmwareHost.scheduleInput(cycle, EXT_CLOCK_IN, HIGH);
+        firmwareHost.scheduleInput(cycle + period / 2, EXT_CLOCK_IN, LOW);
+        if (cycle >= countFrom) {
+            clockPulses++;
+        }
+    }
+    firmwareHost.setEdgeCallback(onEdge, nullptr);
+    firmwareHost.setAnalogValue(FREQ_POT_MPU, div ? TEST_DIV_2_POT : TEST_MULT_3_POT);
+    firmwareHost.setAnalogValue(CHANCE_POT_MPU, 1023);
+    firmwareHost.begin();
+    if (div) {
+        button.click();
+    }
+    firmwareHost.run(end);
+    unsigned long expectedPulses = div ? clockPulses / 2 : 3 * clockPulses;
+    // A burst or gate may be cut in two at the start of the counting.
+    bool passed = highRate && (outputPulses + 1 >= expectedPulses) && (outputPulses <= expectedPulses + 1);
+    printf("%s at %lu Hz: %s, %lu output pulses for %lu clock pulses (expected %lu): %s\n", div ? "DIV 2" : "MULT 3",
+        frequency, highRate ? "high rate mode" : "normal mode", outputPulses, clockPulses, expectedPulses,
+        passed ? "ok" : "FAILED");
+    return(passed);
+}
+
+int main() {
+    bool passed = true;
+    for (int div = 0; div <= 1; div++) {
+        for (unsigned int frequencyCnt = 0; frequencyCnt < sizeof(testFrequencies) / sizeof(testFrequencies[0]); frequencyCnt++) {
+            // The firmware keeps its state in globals, so every run gets a fresh module.
+            fflush(stdout);
+            pid_t child = fork();
+            if (child == 0) {
+                bool childPassed = testFrequency(div, testFrequencies[frequencyCnt]);
+                fflush(stdout);
+                _exit(childPassed ? 0 : 1);
+            }
+            int status = 0;
+            waitpid(child, &status, 0);
+            passed = WIFEXITED(status) && (WEXITSTATUS(status) == 0) && passed;
+        }
+    }
+    return(passed ? 0 : 1);
+}
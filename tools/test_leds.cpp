@@ -0,0 +1,132 @@
+/*
+    Checks the LedCompositor on a Linux host, with the ports of the emulated ATmega328P of
+    FirmwareHost.hpp and without the rest of the firmware:
+    - brightness: a led that is on is lit during brightness ticks of every BAM frame,
+    - flashing: a flashing led changes every flash half period, at any brightness,
+    - writes: a port is only written when its led bits change, and other bits of the port are kept.
+
+    Build and run (from the tools directory):
+        g++ -std=c++11 -O2 -Wall -Ifirmware_host -I../src -o test_leds test_leds.cpp && ./test_leds
+
+    Prints one line per check and exits with 1 if any check failed.
+*/
+
+#include "FirmwareHost.hpp"
+#include "LedCompositor.hpp"
+
+// FirmwareHost runs a firmware; this test has none.
+void setup() {}
+void loop() {}
+
+#define TEST_LED_PIN 6   // D6, port D bit 6.
+#define TEST_OTHER_PIN 8 // D8, port B bit 0.
+#define TEST_SHARED_PIN 5 // D5, port D bit 5: CLOCK_OUT shares its port with the led.
+#define TEST_FLASH_TICKS 5000
+#define TEST_FLASH_HALF_PERIOD 250 // Ticks, for LED_FLASH.
+#define TEST_NR_OF_FRAMES 10
+
+bool isLit(byte pinNumber) {
+    return(*portOutputRegister(digitalPinToPort(pinNumber)) & digitalPinToBitMask(pinNumber));
+}
+
+// Every check starts with a new compositor, so it starts with the ports as after a reset.
+void clearPorts() {
+    *portOutputRegister(digitalPinToPort(TEST_LED_PIN)) = 0;
+    *portOutputRegister(digitalPinToPort(TEST_OTHER_PIN)) = 0;
+}
+
+// Every brightness: lit during brightness ticks of each frame of LED_MAX_BRIGHTNESS ticks.
+bool testBrightness() {
+    bool passed = true;
+    for (byte brightness = 0; brightness <= LED_MAX_BRIGHTNESS; brightness++) {
+        clearPorts();
+        LedCompositor compositor;
+        byte led = compositor.addLed(TEST_LED_PIN, LED_ON);
+        compositor.setBrightness(led, brightness);
+        int litTicks = 0;
+        for (int tickCnt = 0; tickCnt < TEST_NR_OF_FRAMES * LED_MAX_BRIGHTNESS; tickCnt++) {
+            compositor.tick();
+            if (isLit(TEST_LED_PIN)) {
+                litTicks++;
+            }
+        }
+        bool ok = (litTicks == TEST_NR_OF_FRAMES * brightness);
+        printf("brightness %u: lit %d of %d ticks (expected %d): %s\n", brightness, litTicks,
+            TEST_NR_OF_FRAMES * LED_MAX_BRIGHTNESS, TEST_NR_OF_FRAMES * brightness, ok ? "ok" : "FAILED");
+        passed = ok && passed;
+    }
+    return(passed);
+}
+
+// LED_FLASH changes every TEST_FLASH_HALF_PERIOD ticks. At a low brightness the led is only lit during part of each BAM
+// frame, so it counts as lit when it is lit in any tick of the frame. A change is then seen up to a frame early
+// or late, so a half period may be off by two frames.
+bool testFlash(byte brightness) {
+    clearPorts();
+    LedCompositor compositor;
+    byte led = compositor.addLed(TEST_LED_PIN, LED_FLASH);
+    compositor.setBrightness(led, brightness);
+    int changes = 0;
+    int wrongHalfPeriods = 0;
+    bool wasLit = false;
+    int halfPeriodStart = 0;
+    for (int tickCnt = 0; tickCnt < TEST_FLASH_TICKS; tickCnt += LED_MAX_BRIGHTNESS) {
+        bool lit = false;
+        for (byte frameTick = 0; frameTick < LED_MAX_BRIGHTNESS; frameTick++) {
+            compositor.tick();
+            lit = lit || isLit(TEST_LED_PIN);
+        }
+        if (lit != wasLit) {
+            if ((changes > 0) && (abs(tickCnt - halfPeriodStart - TEST_FLASH_HALF_PERIOD) > 2 * LED_MAX_BRIGHTNESS)) {
+                wrongHalfPeriods++;
+            }
+            halfPeriodStart = tickCnt;
+            wasLit = lit;
+            changes++;
+        }
+    }
+    int expectedChanges = TEST_FLASH_TICKS / TEST_FLASH_HALF_PERIOD;
+    bool passed = (abs(changes - expectedChanges) <= 1) && (wrongHalfPeriods == 0);
+    printf("flash at brightness %u: %d changes in %d ticks (expected %d), %d not %d ticks apart: %s\n",
+        brightness, changes, TEST_FLASH_TICKS, expectedChanges, wrongHalfPeriods, TEST_FLASH_HALF_PERIOD,
+        passed ? "ok" : "FAILED");
+    return(passed);
+}
+
+// A led that stays on is written once: a bit cleared behind the compositor's back stays cleared.
+// Writing a changed led keeps the other bits of its port.
+bool testWrites() {
+    clearPorts();
+    LedCompositor compositor;
+    byte led = compositor.addLed(TEST_LED_PIN, LED_ON);
+    compositor.addLed(TEST_OTHER_PIN, LED_OFF);
+    volatile uint8_t *port = portOutputRegister(digitalPinToPort(TEST_LED_PIN));
+    byte bitMask = digitalPinToBitMask(TEST_LED_PIN);
+    compositor.tick();
+    bool writtenOnce = isLit(TEST_LED_PIN);
+    *port &= ~bitMask;
+    for (int tickCnt = 0; tickCnt < 3 * LED_MAX_BRIGHTNESS; tickCnt++) {
+        compositor.tick();
+    }
+    bool notRewritten = !isLit(TEST_LED_PIN);
+    *port |= digitalPinToBitMask(TEST_SHARED_PIN);
+    compositor.setState(led, LED_OFF);
+    compositor.tick();
+    compositor.setState(led, LED_ON);
+    compositor.tick();
+    bool otherBitKept = (*port & digitalPinToBitMask(TEST_SHARED_PIN)) && isLit(TEST_LED_PIN);
+    bool otherPortUntouched = !isLit(TEST_OTHER_PIN);
+    bool passed = writtenOnce && notRewritten && otherBitKept && otherPortUntouched;
+    printf("writes: first tick %s, unchanged led %s, other bits of the port %s, other port %s: %s\n",
+        writtenOnce ? "written" : "not written", notRewritten ? "not rewritten" : "rewritten",
+        otherBitKept ? "kept" : "changed", otherPortUntouched ? "untouched" : "written", passed ? "ok" : "FAILED");
+    return(passed);
+}
+
+int main() {
+    bool passed = testBrightness();
+    passed = testFlash(LED_MAX_BRIGHTNESS) && passed;
+    passed = testFlash(LED_MIN_BRIGHTNESS) && passed;
+    passed = testWrites() && passed;
+    return(passed ? 0 : 1);
+}
@@ -0,0 +1,139 @@
+/*
+    Checks the firmware built with MULTI_CHANNEL on the emulated ATmega328P of FirmwareHost.hpp:
+    with a steady clock and the front panel in MULT with a factor of 3 (chance at 100%), and in DIV 2,
+    - CLOCK_OUT (D5) must follow the front panel,
+    - D10 (MULT 2, chance 50%) must produce 1 or 2 pulses on every beat, 2 on 25 ... 75% of them,
+    - D11 (DIV 2) must produce a gate on every other beat, which lasts until the next clock edge.
+
+    Build and run (from the tools directory):
+        g++ -std=c++11 -O2 -Wall -Ifirmware_host -o test_multi_channel test_multi_channel.cpp && ./test_multi_channel
+
+    Prints one line per check and exits with 1 if any check failed.
+*/
+
+#define MULTI_CHANNEL
+
+#include "FirmwareHost.hpp"
+#include "../src/main.cpp"
+#undef printf
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TEST_BEAT_TIME     500000UL // uS, 120 bpm.
+#define TEST_START_TIME    3000000UL
+#define TEST_NR_OF_BEATS   60
+#define TEST_WARM_UP_BEATS 10
+#define TEST_PULSE_WIDTH   5000     // uS
+#define TEST_TOLERANCE     1000     // uS, for the gate length of D11.
+#define TEST_MULT_3_POT    600      // Selects the fourth entry of potValues4Mult, i.e. a factor of 3.
+#define TEST_DIV_2_POT     233      // Selects the third entry of potValues4Div, i.e. a division of 2.
+
+#define NR_OF_TEST_PINS 3
+const byte testPins[NR_OF_TEST_PINS] = { CLOCK_OUT, 10, 11 };
+
+struct PinStats {
+    int rises[TEST_NR_OF_BEATS];  // Per beat.
+    unsigned long riseTime = 0;
+    unsigned long wrongGates = 0; // Gates of D11 which did not last a beat.
+};
+
+static PinStats pinStats[NR_OF_TEST_PINS];
+
+static void onEdge(void *, uint64_t cycle, uint8_t pinNumber, bool level) {
+    unsigned long time = cycle / FIRMWARE_HOST_CYCLES_PER_US;
+    for (byte pinCnt = 0; pinCnt < NR_OF_TEST_PINS; pinCnt++) {
+        if (testPins[pinCnt] != pinNumber) {
+            continue;
+        }
+        PinStats *stats = &pinStats[pinCnt];
+        if (time < TEST_START_TIME) {
+            return;
+        }
+        // An edge at the clock edge belongs to the beat the clock edge starts.
+        unsigned long beat = (time - TEST_START_TIME) / TEST_BEAT_TIME;
+        if (level) {
+            if (beat < TEST_NR_OF_BEATS) {
+                stats->rises[beat]++;
+            }
+            stats->riseTime = time;
+        } else if ((pinNumber == 11) && (beat >= TEST_WARM_UP_BEATS) && (beat < TEST_NR_OF_BEATS)) {
+            long error = (long)(time - stats->riseTime) - (long) TEST_BEAT_TIME;
+            if ((error > TEST_TOLERANCE) || (error < -TEST_TOLERANCE)) {
+                stats->wrongGates++;
+            }
+        }
+    }
+}
+
+// Run the module with the front panel in MULT 3 (div false) or DIV 2 (div true).
+// Returns true when all checks pass.
+static bool runModule(bool div) {
+    for (int beat = 0; beat <= TEST_NR_OF_BEATS; beat++) {
+        uint64_t cycle = (TEST_START_TIME + beat * TEST_BEAT_TIME) * FIRMWARE_HOST_CYCLES_PER_US;
+        firmwareHost.scheduleInput(cycle, EXT_CLOCK_IN, HIGH);
+        firmwareHost.scheduleInput(cycle + TEST_PULSE_WIDTH * FIRMWARE_HOST_CYCLES_PER_US, EXT_CLOCK_IN, LOW);
+    }
+    firmwareHost.setEdgeCallback(onEdge, nullptr);
+    firmwareHost.setAnalogValue(FREQ_POT_MPU, div ? TEST_DIV_2_POT : TEST_MULT_3_POT);
+    firmwareHost.setAnalogValue(CHANCE_POT_MPU, 1023);
+    firmwareHost.begin();
+    if (div) {
+        button.click();
+    }
+    firmwareHost.runMicros(TEST_START_TIME + (TEST_NR_OF_BEATS + 1) * TEST_BEAT_TIME);
+
+    int wrongMainBeats = 0;
+    int wrongRatchetBeats = 0;
+    int doubleBeats = 0;
+    int wrongDivBeats = 0;
+    int beats = 0;
+    for (int beat = TEST_WARM_UP_BEATS; beat < TEST_NR_OF_BEATS; beat++) {
+        int expectedMain = div ? (pinStats[0].rises[beat] > 0 ? 1 : 0) : 3;
+        if (pinStats[0].rises[beat] != expectedMain) {
+            wrongMainBeats++;
+        }
+        if ((pinStats[1].rises[beat] < 1) || (pinStats[1].rises[beat] > 2)) {
+            wrongRatchetBeats++;
+        }
+        if (pinStats[1].rises[beat] == 2) {
+            doubleBeats++;
+        }
+        // D11 rises on every other beat.
+        if (pinStats[2].rises[beat] + pinStats[2].rises[beat - 1] != 1) {
+            wrongDivBeats++;
+        }
+        beats++;
+    }
+    int mainGates = 0;
+    for (int beat = TEST_WARM_UP_BEATS; div && (beat < TEST_NR_OF_BEATS); beat++) {
+        mainGates += pinStats[0].rises[beat];
+    }
+    if (div && (mainGates != beats / 2)) {
+        wrongMainBeats++;
+    }
+    bool passed = (wrongMainBeats == 0) && (wrongRatchetBeats == 0) && (wrongDivBeats == 0) &&
+        (pinStats[2].wrongGates == 0) && (doubleBeats >= beats / 4) && (doubleBeats <= 3 * beats / 4);
+    printf("front panel %s: D5 %d wrong beats, D10 %d wrong beats and %d of %d beats with 2 pulses, "
+        "D11 %d wrong beats and %lu gates not a beat long: %s\n", div ? "DIV 2" : "MULT 3", wrongMainBeats,
+        wrongRatchetBeats, doubleBeats, beats, wrongDivBeats, pinStats[2].wrongGates, passed ? "ok" : "FAILED");
+    return(passed);
+}
+
+int main() {
+    bool passed = true;
+    for (int div = 0; div <= 1; div++) {
+        // The firmware keeps its state in globals, so every run gets a fresh module.
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            bool childPassed = runModule(div);
+            fflush(stdout);
+            _exit(childPassed ? 0 : 1);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        passed = WIFEXITED(status) && (WEXITSTATUS(status) == 0) && passed;
+    }
+    return(passed ? 0 : 1);
+}
@@ -0,0 +1,130 @@
+/*
+    Checks the RATIO mode of the firmware on the emulated ATmega328P of FirmwareHost.hpp: with a
+    steady clock, a ratio p:q must produce exactly p output pulses during every q clock pulses, the
+    first of them at the clock pulse which synchronises the output, with a duty cycle of about 50%.
+
+    Build and run (from the tools directory):
+        g++ -std=c++11 -O2 -Wall -Ifirmware_host -o test_ratio test_ratio.cpp && ./test_ratio
+
+    Prints one line per ratio and exits with 1 if any check failed.
+*/
+
+#include "FirmwareHost.hpp"
+#include "../src/main.cpp"
+#undef printf
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TEST_BEAT_TIME     500000UL // uS, 120 bpm.
+#define TEST_START_TIME    3000000UL
+#define TEST_NR_OF_BEATS   48
+#define TEST_WARM_UP_BEATS 12
+#define TEST_PULSE_WIDTH   5000     // uS
+#define TEST_SYNC_TOLERANCE 200     // uS, two ratio ticks.
+#define TEST_DUTY_TOLERANCE 5       // Percent.
+
+// Indices into ratioNumerators[] and ratioDenominators[]: 1:4, 1:1, 3:2, 5:4 and 4:1.
+const byte testRatios[] = { 0, 5, 8, 6, 12 };
+
+#define TEST_MAX_RISES (TEST_NR_OF_BEATS * 8)
+static unsigned long riseTimes[TEST_MAX_RISES];
+static unsigned long highTimes[TEST_MAX_RISES]; // How long the output stayed high after each rise.
+static int nrOfRises = 0;
+
+static void onEdge(void *, uint64_t cycle, uint8_t pinNumber, bool level) {
+    unsigned long time = cycle / FIRMWARE_HOST_CYCLES_PER_US;
+    if ((pinNumber != CLOCK_OUT) || (time < TEST_START_TIME + TEST_WARM_UP_BEATS * TEST_BEAT_TIME)) {
+        return;
+    }
+    if (level) {
+        if (nrOfRises < TEST_MAX_RISES) {
+            riseTimes[nrOfRises] = time;
+            highTimes[nrOfRises++] = 0;
+        }
+    } else if (nrOfRises > 0) {
+        highTimes[nrOfRises - 1] = time - riseTimes[nrOfRises - 1];
+    }
+}
+
+static bool testRatio(byte ratio) {
+    byte p = ratioNumerators[ratio];
+    byte q = ratioDenominators[ratio];
+    for (int beat = 0; beat <= TEST_NR_OF_BEATS; beat++) {
+        uint64_t cycle = (TEST_START_TIME + beat * TEST_BEAT_TIME) * FIRMWARE_HOST_CYCLES_PER_US;
+        firmwareHost.scheduleInput(cycle, EXT_CLOCK_IN, HIGH);
+        firmwareHost.scheduleInput(cycle + TEST_PULSE_WIDTH * FIRMWARE_HOST_CYCLES_PER_US, EXT_CLOCK_IN, LOW);
+    }
+    firmwareHost.setEdgeCallback(onEdge, nullptr);
+    // The middle of the pot range of this ratio.
+    firmwareHost.setAnalogValue(FREQ_POT_MPU, (2 * ratio + 1) * 1024 / (2 * NR_OF_RATIOS));
+    firmwareHost.begin();
+    // MULT -> MAX_MULT -> RATIO.
+    button.doubleClick();
+    button.doubleClick();
+    firmwareHost.runMicros(TEST_START_TIME + TEST_NR_OF_BEATS * TEST_BEAT_TIME);
+
+    // Which clock pulses synchronise the output depends on when RATIO was selected: the windows start
+    // at the first rise after the warm up which is at a clock pulse.
+    int firstBeat = TEST_NR_OF_BEATS;
+    for (int riseCnt = 0; (riseCnt < nrOfRises) && (firstBeat == TEST_NR_OF_BEATS); riseCnt++) {
+        unsigned long sinceBeat = (riseTimes[riseCnt] - TEST_START_TIME) % TEST_BEAT_TIME;
+        if (sinceBeat <= TEST_SYNC_TOLERANCE) {
+            firstBeat = (riseTimes[riseCnt] - TEST_START_TIME) / TEST_BEAT_TIME;
+        }
+    }
+    // Windows of q clock pulses, each should start with a synchronised rise and hold p rises.
+    int windows = 0;
+    int wrongWindows = 0;
+    int unsynchronisedWindows = 0;
+    unsigned long highTime = 0;
+    int riseCnt = 0;
+    while ((riseCnt < nrOfRises) && (riseTimes[riseCnt] < TEST_START_TIME + firstBeat * TEST_BEAT_TIME)) {
+        riseCnt++;
+    }
+    for (int beat = firstBeat; beat + q <= TEST_NR_OF_BEATS; beat += q) {
+        unsigned long windowStart = TEST_START_TIME + beat * TEST_BEAT_TIME;
+        unsigned long windowEnd = windowStart + q * TEST_BEAT_TIME;
+        int rises = 0;
+        bool synchronised = false;
+        for (; (riseCnt < nrOfRises) && (riseTimes[riseCnt] < windowEnd - TEST_SYNC_TOLERANCE); riseCnt++) {
+            if (riseTimes[riseCnt] - windowStart <= TEST_SYNC_TOLERANCE) {
+                synchronised = true;
+            }
+            highTime += highTimes[riseCnt];
+            rises++;
+        }
+        if (rises != p) {
+            wrongWindows++;
+        }
+        if (!synchronised) {
+            unsynchronisedWindows++;
+        }
+        windows++;
+    }
+    unsigned long measuredTime = windows * q * TEST_BEAT_TIME;
+    int duty = (int)(100 * highTime / measuredTime);
+    bool passed = (windows > 0) && (wrongWindows == 0) && (unsynchronisedWindows == 0) &&
+        (duty >= 50 - TEST_DUTY_TOLERANCE) && (duty <= 50 + TEST_DUTY_TOLERANCE);
+    printf("RATIO %u:%u: %d of %d windows without %u pulses, %d not synchronised, duty cycle %d%%: %s\n",
+        p, q, wrongWindows, windows, p, unsynchronisedWindows, duty, passed ? "ok" : "FAILED");
+    return(passed);
+}
+
+int main() {
+    bool passed = true;
+    for (unsigned int ratioCnt = 0; ratioCnt < sizeof(testRatios); ratioCnt++) {
+        // The firmware keeps its state in globals, so every ratio gets a fresh module.
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            bool childPassed = testRatio(testRatios[ratioCnt]);
+            fflush(stdout);
+            _exit(childPassed ? 0 : 1);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        passed = WIFEXITED(status) && (WEXITSTATUS(status) == 0) && passed;
+    }
+    return(passed ? 0 : 1);
+}
@@ -0,0 +1,163 @@
+/*
+    Checks the reset input of the firmware on the emulated ATmega328P of FirmwareHost.hpp, with a
+    steady clock and resets at several moments of a beat, in MULT 3 and in DIV 2:
+    - the output must be high at the reset edge itself, i.e. no analog read or other slow work may
+      run with interrupts disabled before the reset routine sets it (the emulator runs code in zero
+      time, so this is the reset-to-output latency apart from the run time of the code itself),
+    - in MULT the running burst must be stopped and a new one started at the reset edge,
+    - a clock pulse less than 1/RESET_GUARD_FRACTION of a cycle after the reset must belong to the same
+      beat, so that beat still has exactly 3 pulses.
+
+    Build and run (from the tools directory):
+        g++ -std=c++11 -O2 -Wall -Ifirmware_host -o test_reset test_reset.cpp && ./test_reset
+
+    Prints one line per mode and exits with 1 if any check failed.
+*/
+
+#include "FirmwareHost.hpp"
+#include "../src/main.cpp"
+#undef printf
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TEST_BEAT_TIME     500000UL // uS, 120 bpm.
+#define TEST_START_TIME    3000000UL
+#define TEST_NR_OF_BEATS   24
+#define TEST_FIRST_RESET   12       // Beat.
+#define TEST_PULSE_WIDTH   5000     // uS
+#define TEST_TOLERANCE     1000     // uS, for the output after a reset and its first half period.
+#define TEST_MULT_3_POT    600      // Selects the fourth entry of potValues4Mult, i.e. a factor of 3.
+#define TEST_DIV_2_POT     233      // Selects the third entry of potValues4Div, i.e. a division of 2.
+
+// When the reset comes, relative to the clock pulse of its beat (in uS): just before it, together with it,
+// and during the beat.
+const long testResetPhases[] = { -1000, 0, 150000, 300000, 420000 };
+#define TEST_NR_OF_RESETS (sizeof(testResetPhases) / sizeof(testResetPhases[0]))
+
+#define TEST_MAX_EDGES 1000
+static uint64_t edgeCycles[TEST_MAX_EDGES];
+static bool edgeLevels[TEST_MAX_EDGES];
+static int nrOfEdges = 0;
+
+static void onEdge(void *, uint64_t cycle, uint8_t pinNumber, bool level) {
+    if ((pinNumber == CLOCK_OUT) && (nrOfEdges < TEST_MAX_EDGES)) {
+        edgeCycles[nrOfEdges] = cycle;
+        edgeLevels[nrOfEdges++] = level;
+    }
+}
+
+// The first edge at or after cycle.
+static int findEdge(uint64_t cycle) {
+    int edgeCnt = 0;
+    while ((edgeCnt < nrOfEdges) && (edgeCycles[edgeCnt] < cycle)) {
+        edgeCnt++;
+    }
+    return(edgeCnt);
+}
+
+static int countRises(uint64_t from, uint64_t to) {
+    int rises = 0;
+    for (int edgeCnt = findEdge(from); (edgeCnt < nrOfEdges) && (edgeCycles[edgeCnt] < to); edgeCnt++) {
+        if (edgeLevels[edgeCnt]) {
+            rises++;
+        }
+    }
+    return(rises);
+}
+
+static uint64_t toCycle(unsigned long time) {
+    return((uint64_t) time * FIRMWARE_HOST_CYCLES_PER_US);
+}
+
+// Run the module in MULT 3 (div false) or DIV 2 (div true). Returns true when all checks pass.
+static bool testResets(bool div) {
+    for (int beat = 0; beat <= TEST_NR_OF_BEATS; beat++) {
+        uint64_t cycle = toCycle(TEST_START_TIME + beat * TEST_BEAT_TIME);
+        firmwareHost.scheduleInput(cycle, EXT_CLOCK_IN, HIGH);
+        firmwareHost.scheduleInput(cycle + toCycle(TEST_PULSE_WIDTH), EXT_CLOCK_IN, LOW);
+    }
+    // One reset every other beat, so the tempo and the divider settle in between.
+    unsigned long resetTimes[TEST_NR_OF_RESETS];
+    for (unsigned int resetCnt = 0; resetCnt < TEST_NR_OF_RESETS; resetCnt++) {
+        resetTimes[resetCnt] = TEST_START_TIME + (TEST_FIRST_RESET + 2 * resetCnt) * TEST_BEAT_TIME + testResetPhases[resetCnt];
+        firmwareHost.scheduleInput(toCycle(resetTimes[resetCnt]), EXT_RESET_MPU, HIGH);
+        firmwareHost.scheduleInput(toCycle(resetTimes[resetCnt] + TEST_PULSE_WIDTH), EXT_RESET_MPU, LOW);
+    }
+    firmwareHost.setEdgeCallback(onEdge, nullptr);
+    firmwareHost.setAnalogValue(FREQ_POT_MPU, div ? TEST_DIV_2_POT : TEST_MULT_3_POT);
+    firmwareHost.setAnalogValue(CHANCE_POT_MPU, 1023);
+    firmwareHost.begin();
+    if (div) {
+        button.click();
+    }
+    firmwareHost.runMicros(TEST_START_TIME + (TEST_NR_OF_BEATS + 1) * TEST_BEAT_TIME);
+
+    uint64_t maxLatency = 0; // Cycles.
+    int lowAfterReset = 0;
+    int notRestarted = 0;
+    int wrongBeats = 0;
+    for (unsigned int resetCnt = 0; resetCnt < TEST_NR_OF_RESETS; resetCnt++) {
+        uint64_t resetCycle = toCycle(resetTimes[resetCnt]);
+        // The level at the reset edge is that of the last edge up to and including it. If that is low,
+        // the output is late: take the first rise after the reset.
+        int edgeCnt = findEdge(resetCycle + 1) - 1;
+        bool high = (edgeCnt >= 0) && edgeLevels[edgeCnt];
+        if (!high && (edgeCnt + 1 < nrOfEdges) && edgeLevels[edgeCnt + 1] &&
+            (edgeCycles[edgeCnt + 1] < resetCycle + toCycle(TEST_TOLERANCE))) {
+            high = true;
+            edgeCnt++;
+        }
+        if (high && (edgeCycles[edgeCnt] >= resetCycle)) {
+            maxLatency = max(maxLatency, edgeCycles[edgeCnt] - resetCycle);
+        }
+        if (!high) {
+            lowAfterReset++;
+            continue;
+        }
+        if (div) {
+            continue;
+        }
+        // The burst started by the reset: its first half period starts at the reset edge and is as long
+        // as the next one. The tempo is still settling, so the half period is not exactly a sixth of a beat.
+        int fall = edgeCnt + 1;
+        bool restarted = false;
+        if (fall + 1 < nrOfEdges) {
+            long firstHalfPeriod = (long)((edgeCycles[fall] - resetCycle) / FIRMWARE_HOST_CYCLES_PER_US);
+            long secondHalfPeriod = (long)((edgeCycles[fall + 1] - edgeCycles[fall]) / FIRMWARE_HOST_CYCLES_PER_US);
+            restarted = (labs(firstHalfPeriod - secondHalfPeriod) <= TEST_TOLERANCE) &&
+                (labs(firstHalfPeriod - (long)(TEST_BEAT_TIME / 6)) <= (long)(TEST_BEAT_TIME / 24));
+        }
+        if (!restarted) {
+            notRestarted++;
+        }
+        // A reset just before or together with the clock pulse starts the beat of that clock pulse.
+        if ((testResetPhases[resetCnt] <= 0) &&
+            (countRises(resetCycle, resetCycle + toCycle(TEST_BEAT_TIME - TEST_TOLERANCE)) != 3)) {
+            wrongBeats++;
+        }
+    }
+    bool passed = (maxLatency == 0) && (lowAfterReset == 0) && (notRestarted == 0) && (wrongBeats == 0);
+    printf("%s: %d of %u resets without output, latency up to %lu cycles, %d bursts not restarted, "
+        "%d beats at a reset without 3 pulses: %s\n", div ? "DIV 2" : "MULT 3", lowAfterReset,
+        (unsigned int) TEST_NR_OF_RESETS, (unsigned long) maxLatency, notRestarted, wrongBeats, passed ? "ok" : "FAILED");
+    return(passed);
+}
+
+int main() {
+    bool passed = true;
+    for (int div = 0; div <= 1; div++) {
+        // The firmware keeps its state in globals, so every run gets a fresh module.
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            bool childPassed = testResets(div);
+            fflush(stdout);
+            _exit(childPassed ? 0 : 1);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        passed = WIFEXITED(status) && (WEXITSTATUS(status) == 0) && passed;
+    }
+    return(passed ? 0 : 1);
+}
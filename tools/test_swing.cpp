@@ -0,0 +1,95 @@
+/*
+    Checks the SwingTracker on a Linux host: fed a clock, it must find the pattern length of the clock
+    within TEST_RECOGNISE_INTERVALS intervals and keep it (the manual says about 8 gates for 2 steps
+    and about 14 for 3 steps), and after
+    TEST_NR_OF_INTERVALS intervals predict the next intervals within TEST_TOLERANCE_PERCENT.
+    A straight clock with jitter must not be taken for a swung one, and after a pause the tracker
+    must start again from the interval after it.
+
+    Build and run (from the tools directory):
+        g++ -std=c++11 -O2 -Wall -I../src -o test_swing test_swing.cpp && ./test_swing
+
+    Prints one line per clock and exits with 1 if any check failed.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include "SwingTracker.hpp"
+
+#define TEST_NR_OF_INTERVALS 48
+#define TEST_RECOGNISE_INTERVALS 16
+#define TEST_TOLERANCE_PERCENT 2
+#define TEST_JITTER 5000 // uS, 1% of a 500 mS interval.
+
+struct TestClock {
+    const char *name;
+    uint8_t patternLength;         // Expected.
+    uint32_t intervals[SWING_MAX_STEPS];
+    bool jitter;
+};
+
+const TestClock testClocks[] = {
+    { "straight 120 bpm", 1, { 500000 }, false },
+    { "straight with 1% jitter", 1, { 500000 }, true },
+    { "swing 60%", 2, { 600000, 400000 }, false },
+    { "swing 67%, fast", 2, { 80000, 40000 }, false },
+    { "long short short", 3, { 500000, 250000, 250000 }, false },
+};
+
+// Predictions within TEST_TOLERANCE_PERCENT of interval.
+bool isClose(uint32_t prediction, uint32_t interval) {
+    uint32_t difference = (prediction > interval) ? prediction - interval : interval - prediction;
+    return(difference * 100 <= interval * TEST_TOLERANCE_PERCENT);
+}
+
+bool testClock(const TestClock *clock) {
+    SwingTracker tracker;
+    srand(1234);
+    int recognisedAfter = 0; // Intervals after which the pattern length was right from then on.
+    for (int intervalCnt = 0; intervalCnt < TEST_NR_OF_INTERVALS; intervalCnt++) {
+        uint32_t interval = clock->intervals[intervalCnt % clock->patternLength];
+        if (clock->jitter) {
+            interval += rand() % (2 * TEST_JITTER + 1) - TEST_JITTER;
+        }
+        tracker.addInterval(interval);
+        if (tracker.getPatternLength() != clock->patternLength) {
+            recognisedAfter = intervalCnt + 2;
+        }
+    }
+    bool predicted = true;
+    for (uint8_t stepsAhead = 0; stepsAhead < 2 * SWING_MAX_STEPS; stepsAhead++) {
+        uint32_t interval = clock->intervals[(TEST_NR_OF_INTERVALS + stepsAhead) % clock->patternLength];
+        if (!isClose(tracker.getInterval(stepsAhead), interval)) {
+            predicted = false;
+        }
+    }
+    bool passed = tracker.isStarted() && (recognisedAfter <= TEST_RECOGNISE_INTERVALS) && predicted;
+    printf("%s: pattern length %u (expected %u) after %d intervals, next interval %lu uS, predictions %s: %s\n",
+        clock->name, tracker.getPatternLength(), clock->patternLength, recognisedAfter,
+        (unsigned long) tracker.getInterval(0), predicted ? "ok" : "off", passed ? "ok" : "FAILED");
+    return(passed);
+}
+
+// A pause stops the tracker; the interval after it starts it again at the new tempo.
+bool testPause() {
+    SwingTracker tracker;
+    for (int intervalCnt = 0; intervalCnt < TEST_NR_OF_INTERVALS; intervalCnt++) {
+        tracker.addInterval(500000);
+    }
+    tracker.addInterval(5000000);
+    bool stoppedByPause = !tracker.isStarted();
+    tracker.addInterval(300000);
+    bool passed = stoppedByPause && tracker.isStarted() && (tracker.getInterval(0) == 300000);
+    printf("pause: %s by the pause, next interval %lu uS (expected 300000 uS): %s\n",
+        stoppedByPause ? "stopped" : "not stopped", (unsigned long) tracker.getInterval(0), passed ? "ok" : "FAILED");
+    return(passed);
+}
+
+int main() {
+    bool passed = true;
+    for (unsigned int clockCnt = 0; clockCnt < sizeof(testClocks) / sizeof(testClocks[0]); clockCnt++) {
+        passed = testClock(&testClocks[clockCnt]) && passed;
+    }
+    passed = testPause() && passed;
+    return(passed ? 0 : 1);
+}